@@ -0,0 +1,13 @@
+// Lower bound on the distance in voxels from anywhere in a 4^3 brick of the dense grid to the nearest
+// geometry, built by distanceField.comp
+
+uniform bool useDistanceField = false;
+uniform sampler3D distanceField;
+
+// p in voxels, 0 outside the grid
+float fieldDistance(vec3 p) {
+	ivec3 brick = ivec3(floor(p / 4.0));
+	if (any(lessThan(brick, ivec3(0))) || any(greaterThanEqual(brick, textureSize(distanceField, 0))))
+		return 0.0;
+	return texelFetch(distanceField, brick, 0).r;
+}
@@ -0,0 +1,58 @@
+#version 450 core
+
+#define NORMAL_MAP
+
+in VS_OUT {
+    vec3 fragPosition;
+    vec3 fragNormal;
+    vec2 fragTexcoord;
+
+    vec4 lightFragPos;
+
+#ifdef NORMAL_MAP
+	mat3 TBN;
+    vec3 tangentLightPos;
+    vec3 tangentViewPos;
+    vec3 tangentFragPos;
+#endif
+} fs_in;
+
+uniform struct Material {
+	vec3 ambient, diffuse, specular;
+	float shininess;
+
+	bool hasAmbientMap, hasDiffuseMap, hasSpecularMap, hasAlphaMap;
+	bool hasNormalMap;
+} material = Material(vec3(0), vec3(0), vec3(0), 32.0, false, false, false, false, false);
+
+// Diffuse color
+layout(binding = 0) uniform sampler2D texture0;
+
+#ifdef NORMAL_MAP
+layout(binding = 5) uniform sampler2D normalMap;
+#endif
+
+uniform bool enableNormalMap = true;
+
+// Position is reconstructed from depth. Normal and tangent are stored exactly as phong.vert
+// outputs them so the deferred pass traces the same cones as the forward pass.
+layout(location = 0) out vec4 gAlbedo;
+layout(location = 1) out vec4 gNormal;  // xyz: geometric normal, w: shininess
+layout(location = 2) out vec4 gTangent; // xyz: tangent
+layout(location = 3) out vec4 gShading; // xyz: shading normal, w: 1 if in tangent space
+
+void main() {
+	gAlbedo = texture(texture0, fs_in.fragTexcoord);
+	gNormal = vec4(fs_in.TBN[2], material.shininess);
+	gTangent = vec4(fs_in.TBN[0], 0);
+
+#ifdef NORMAL_MAP
+	if (enableNormalMap) {
+		gShading = vec4(normalize(texture(normalMap, fs_in.fragTexcoord).rgb * 2.0 - 1.0), 1);
+	}
+	else
+#endif
+	{
+		gShading = vec4(normalize(fs_in.fragNormal), 0);
+	}
+}
@@ -0,0 +1,52 @@
+// G-buffer written by gbuffer.frag, read by the deferred compute passes.
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;  // xyz: geometric normal, w: shininess
+uniform sampler2D gTangent; // xyz: tangent
+uniform sampler2D gShading; // xyz: shading normal, w: 1 if in tangent space
+uniform sampler2D gDepth;
+
+uniform mat4 invViewProjection;
+uniform float near = 0.1, far = 100.0;
+
+// Indirect lighting may be traced at reduced resolution, either one sample per indirectScale^2 block
+// or every other pixel in a checkerboard
+uniform int indirectScale = 1;
+uniform bool checkerboard = false;
+
+vec3 reconstructPosition(ivec2 pixel, float depth) {
+	vec2 uv = (vec2(pixel) + 0.5) / vec2(textureSize(gDepth, 0));
+	vec4 world = invViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1);
+	return world.xyz / world.w;
+}
+
+float linearDepth(float depth) {
+	float z = depth * 2.0 - 1.0;
+	return 2.0 * near * far / (far + near - z * (far - near));
+}
+
+// Rebuilds the TBN the same way phong.vert does
+mat3 gbufferTBN(ivec2 pixel) {
+	vec3 N = texelFetch(gNormal, pixel, 0).xyz;
+	vec3 T = texelFetch(gTangent, pixel, 0).xyz;
+	return mat3(T, cross(N, T), N);
+}
+
+ivec2 indirectSize(ivec2 size) {
+	if (checkerboard) {
+		return ivec2((size.x + 1) / 2, size.y);
+	}
+	return (size + indirectScale - 1) / indirectScale;
+}
+
+// Full resolution pixel that the indirect buffer texel was traced at
+ivec2 indirectSamplePixel(ivec2 texel, ivec2 size) {
+	ivec2 pixel;
+	if (checkerboard) {
+		pixel = ivec2(2 * texel.x + (texel.y & 1), texel.y);
+	}
+	else {
+		pixel = texel * indirectScale + indirectScale / 2;
+	}
+	return min(pixel, size - 1);
+}
@@ -0,0 +1,97 @@
+// Reading the indirect buffer written by indirectLighting.comp, needs gbuffer.glsl.
+
+uniform sampler2D indirectBuffer;
+
+// Joint bilateral weight of an indirect sample, low when its depth or normal differs from the pixel being
+// shaded so light does not bleed across depth discontinuities
+float bilateralWeight(ivec2 samplePixel, float z, vec3 n) {
+	float sampleZ = linearDepth(texelFetch(gDepth, samplePixel, 0).r);
+	vec3 sampleN = normalize(texelFetch(gNormal, samplePixel, 0).xyz);
+
+	float depthWeight = exp(-abs(sampleZ - z) / (0.02 * z));
+	float normalWeight = pow(max(dot(sampleN, n), 0.0), 16.0);
+
+	return depthWeight * normalWeight;
+}
+
+// Full resolution indirect light at pixel from the reduced resolution indirect buffer
+vec3 upsampleIndirect(ivec2 pixel, ivec2 size, vec3 n) {
+	float z = linearDepth(texelFetch(gDepth, pixel, 0).r);
+	ivec2 lowSize = indirectSize(size);
+
+	ivec2 texels[4];
+	float weights[4];
+	bool valid[4] = bool[](true, true, true, true);
+
+	if (checkerboard) {
+		// Traced pixel, use it directly
+		if (((pixel.x ^ pixel.y) & 1) == 0) {
+			return texelFetch(indirectBuffer, ivec2(pixel.x / 2, pixel.y), 0).rgb;
+		}
+
+		// All four direct neighbours were traced
+		const ivec2 offsets[4] = ivec2[](ivec2(-1, 0), ivec2(1, 0), ivec2(0, -1), ivec2(0, 1));
+		for (int i = 0; i < 4; i++) {
+			ivec2 neighbour = pixel + offsets[i];
+			valid[i] = all(greaterThanEqual(neighbour, ivec2(0))) && all(lessThan(neighbour, size));
+			texels[i] = ivec2(neighbour.x / 2, neighbour.y);
+			weights[i] = 0.25;
+		}
+	}
+	else {
+		vec2 coord = vec2(pixel - indirectScale / 2) / float(indirectScale);
+		ivec2 base = ivec2(floor(coord));
+		vec2 f = coord - vec2(base);
+
+		const ivec2 offsets[4] = ivec2[](ivec2(0, 0), ivec2(1, 0), ivec2(0, 1), ivec2(1, 1));
+		for (int i = 0; i < 4; i++) {
+			texels[i] = clamp(base + offsets[i], ivec2(0), lowSize - 1);
+			vec2 w = mix(1.0 - f, f, vec2(offsets[i]));
+			weights[i] = w.x * w.y;
+		}
+	}
+
+	vec3 indirect = vec3(0);
+	float totalWeight = 0.0;
+	float bestWeight = -1.0;
+	vec3 best = vec3(0);
+	for (int i = 0; i < 4; i++) {
+		if (!valid[i]) continue;
+
+		float w = bilateralWeight(indirectSamplePixel(texels[i], size), z, n);
+		vec3 value = texelFetch(indirectBuffer, texels[i], 0).rgb;
+
+		indirect += weights[i] * w * value;
+		totalWeight += weights[i] * w;
+
+		if (w > bestWeight) {
+			bestWeight = w;
+			best = value;
+		}
+	}
+
+	// No sample lies on the same surface, take the closest match instead of blurring across the edge
+	if (totalWeight < 1e-4) {
+		return best;
+	}
+
+	return indirect / totalWeight;
+}
+
+// Mean and standard deviation of the 3x3 indirect buffer texels around pixel, in the buffer's own resolution
+void indirectNeighbourhood(ivec2 pixel, ivec2 size, out vec3 mean, out vec3 deviation) {
+	ivec2 lowSize = indirectSize(size);
+	ivec2 center = checkerboard ? ivec2(pixel.x / 2, pixel.y) : pixel / indirectScale;
+
+	vec3 m1 = vec3(0), m2 = vec3(0);
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			vec3 value = texelFetch(indirectBuffer, clamp(center + ivec2(x, y), ivec2(0), lowSize - 1), 0).rgb;
+			m1 += value;
+			m2 += value * value;
+		}
+	}
+
+	mean = m1 / 9.0;
+	deviation = sqrt(max(m2 / 9.0 - mean * mean, vec3(0)));
+}
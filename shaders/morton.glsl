@@ -0,0 +1,28 @@
+// Morton order of 10 bit per axis voxel coordinates, x in the lowest bit of each triple. Voxels of a 2^n
+// cube aligned to 2^n are contiguous, so a list sorted by this key is also sorted brick by brick.
+
+uint mortonSpread(uint v) {
+	v &= 0x3FFu;
+	v = (v | (v << 16)) & 0x030000FFu;
+	v = (v | (v << 8)) & 0x0300F00Fu;
+	v = (v | (v << 4)) & 0x030C30C3u;
+	v = (v | (v << 2)) & 0x09249249u;
+	return v;
+}
+
+uint mortonCompact(uint v) {
+	v &= 0x09249249u;
+	v = (v | (v >> 2)) & 0x030C30C3u;
+	v = (v | (v >> 4)) & 0x0300F00Fu;
+	v = (v | (v >> 8)) & 0x030000FFu;
+	v = (v | (v >> 16)) & 0x3FFu;
+	return v;
+}
+
+uint mortonEncode(uvec3 voxel) {
+	return mortonSpread(voxel.x) | (mortonSpread(voxel.y) << 1) | (mortonSpread(voxel.z) << 2);
+}
+
+uvec3 mortonDecode(uint key) {
+	return uvec3(mortonCompact(key), mortonCompact(key >> 1), mortonCompact(key >> 2));
+}
@@ -0,0 +1,35 @@
+// Bit packed occupancy of the dense grid, built by buildOccupancy.comp. occupancyBricks holds a uvec2 per 16^3
+// region with one bit per 4^3 brick, so a zero texel is an empty region. occupancyVoxels holds a uvec2 per
+// 4^3 brick with one bit per voxel. Bit index is x + 4 * y + 16 * z, bits 32 and up in .y.
+
+uniform bool useOccupancy = false;
+uniform usampler3D occupancyBricks;
+
+bool occupancyBit(uvec2 bits, ivec3 cell) {
+	int index = cell.x + 4 * cell.y + 16 * cell.z;
+	uint word = index < 32 ? bits.x : bits.y;
+	return (word & (1u << uint(index & 31))) != 0u;
+}
+
+// Distance along direction, in voxels, from p to where the empty 16^3 region or 4^3 brick around it ends.
+// 0 when p's brick has geometry or p is outside the grid. direction is in voxels too.
+float emptySpaceDistance(vec3 p, vec3 direction) {
+	ivec3 dims = textureSize(occupancyBricks, 0) * 16;
+	if (any(lessThan(p, vec3(0))) || any(greaterThanEqual(p, vec3(dims))))
+		return 0.0;
+
+	ivec3 voxel = ivec3(p);
+	uvec2 bits = texelFetch(occupancyBricks, voxel >> 4, 0).xy;
+	float size = 16.0;
+	if (bits != uvec2(0)) {
+		if (occupancyBit(bits, (voxel >> 2) & 3))
+			return 0.0;
+		size = 4.0;
+	}
+
+	// Exit through the cell's far planes, axes the ray runs parallel to give +inf
+	vec3 cellMin = floor(p / size) * size;
+	vec3 exitPlanes = cellMin + step(vec3(0), direction) * size;
+	vec3 t = (exitPlanes - p) / direction;
+	return min(t.x, min(t.y, t.z));
+}
@@ -13,6 +13,9 @@ uniform vec3 lightPos;
 uniform vec3 eye;
 #endif
 
+// Depth prepass and forward pass must produce identical depths
+invariant gl_Position;
+
 uniform mat4 projection;
 uniform mat4 view;
 uniform mat4 model;
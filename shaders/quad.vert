@@ -0,0 +1,11 @@
+#version 330
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec2 tc;
+
+out vec2 fragTexcoord;
+
+void main() {
+    gl_Position = vec4(pos, 1);
+    fragTexcoord = tc;
+}
@@ -8,6 +8,12 @@ layout(binding = 0) uniform sampler3D voxelColor;
 layout(binding = 1) uniform sampler3D voxelNormal;
 layout(binding = 2) uniform sampler3D voxelRadiance;
 
+#include "voxelStorage.glsl"
+
+#ifdef VOXEL_PACKED
+layout(binding = 5) uniform sampler3D voxelOpacity;
+#endif
+
 uniform vec3 eye = vec3(0);
 uniform vec3 viewForward = vec3(0, 0, -1);
 uniform vec3 viewRight = vec3(1, 0, 0);
@@ -17,36 +23,52 @@ uniform int width = 1280, height = 720;
 
 uniform float near = 0.1, far = 100.0;
 
-uniform int voxelDim = 128;
+// Maps world space to the grid's [0, 1] texture coordinates
+uniform mat4 worldToVoxel;
 
 uniform int lod = 0;
 
-ivec3 voxelIndex(vec3 pos) {
-    const float minx = -20, maxx = 20,
-        miny = -20, maxy = 20,
-        minz = -20, maxz = 20;
-
-    float rangex = maxx - minx;
-    float rangey = maxy - miny;
-    float rangez = maxz - minz;
-
-    float x = voxelDim * ((pos.x - minx) / rangex);
-    float y = voxelDim * ((pos.y - miny) / rangey);
-    float z = voxelDim * (1 - (pos.z - minz) / rangez);
-
-    return ivec3(x, y, z);
-}
+#include "occupancy.glsl"
+#include "distanceField.glsl"
 
 void main() {
     vec3 rayStart = eye;
     vec2 offset = (gl_FragCoord.xy / vec2(width, height)) * 2 - 1;
     vec3 rayDir = normalize(viewForward + offset.x * viewRight + offset.y * viewUp);
 
+    // Only march the part of the ray inside the grid
+    vec3 origin = (worldToVoxel * vec4(rayStart, 1)).xyz;
+    vec3 direction = mat3(worldToVoxel) * rayDir;
+    vec3 t0 = (vec3(0) - origin) / direction;
+    vec3 t1 = (vec3(1) - origin) / direction;
+    vec3 tMin = min(t0, t1), tMax = max(t0, t1);
+    float tEnter = max(tMin.x, max(tMin.y, tMin.z));
+    float tExit = min(tMax.x, min(tMax.y, tMax.z));
+
+    vec3 dims = vec3(textureSize(voxelRadiance, 0));
+    vec3 voxelDir = direction * dims;
+    float voxelsPerUnit = length(voxelDir);
+
     vec4 value = vec4(0, 0, 0, 0);
-    float scale = 1.0;
-    while (value.a < 1 && scale < far) {
-        vec3 voxelCoords = voxelIndex(rayStart + scale * rayDir) / float(voxelDim);
-        vec4 sampleColor = textureLod(voxelRadiance, voxelCoords, lod);
+    float scale = max(1.0, tEnter);
+    float end = min(far, tExit);
+    while (value.a < 1 && scale < end) {
+        vec3 voxelCoords = origin + scale * direction;
+        // Sphere trace through empty space, stopping short of geometry by the mip footprint
+        vec3 p = voxelCoords * dims;
+        float skip = 0.0;
+        if (useOccupancy) {
+            skip = emptySpaceDistance(p, voxelDir);
+        }
+        if (useDistanceField) {
+            skip = max(skip, fieldDistance(p));
+        }
+        skip -= float(1 << lod);
+        if (skip > 0.0) {
+            scale += max(skip / voxelsPerUnit, 0.2);
+            continue;
+        }
+        vec4 sampleColor = sampleRadiance(voxelRadiance, voxelOpacity, voxelCoords, lod);
         float alpha = 1 - value.a;
         value.rgb += sampleColor.rgb * alpha;
         value.a += sampleColor.a * alpha;
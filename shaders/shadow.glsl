@@ -0,0 +1,47 @@
+// Cascaded shadowmap lookup shared by shading (vct.glsl) and clipmap radiance injection.
+
+#define MAX_SHADOW_CASCADES 4
+
+// Layers 0 to shadowCascades - 1 cover slices of the view frustum, layer MAX_SHADOW_CASCADES the voxel volume
+uniform sampler2DArray shadowmap;
+uniform mat4 shadowMatrices[MAX_SHADOW_CASCADES + 1];
+uniform int shadowCascades = 1;
+
+float calcShadowFactor(vec3 position) {
+	// Finest cascade containing the point, the voxel volume layer covers anything past the last one
+	int layer = MAX_SHADOW_CASCADES;
+	vec4 lsPosition = shadowMatrices[layer] * vec4(position, 1);
+	for (int i = 0; i < shadowCascades; i++) {
+		vec4 cascadePosition = shadowMatrices[i] * vec4(position, 1);
+		if (all(lessThan(abs(cascadePosition.xy), vec2(0.99)))) {
+			layer = i;
+			lsPosition = cascadePosition;
+			break;
+		}
+	}
+
+	vec3 shifted = (lsPosition.xyz / lsPosition.w + 1.0) * 0.5;
+
+	float shadowFactor = 0;
+	float bias = 0.01;
+	float fragDepth = shifted.z - bias;
+
+	if (fragDepth > 1.0) {
+		return 0;
+	}
+
+	const int numSamples = 5;
+	const ivec2 offsets[numSamples] = ivec2[](
+		ivec2(0, 0), ivec2(1, 0), ivec2(0, 1), ivec2(-1, 0), ivec2(0, -1)
+	);
+
+	// Explicit lod so this also works outside of fragment shaders
+	for (int i = 0; i < numSamples; i++) {
+		if (fragDepth > textureLodOffset(shadowmap, vec3(shifted.xy, layer), 0, offsets[i]).r) {
+			shadowFactor += 1;
+		}
+	}
+	shadowFactor /= numSamples;
+
+    return shadowFactor;
+}
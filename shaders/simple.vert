@@ -4,6 +4,9 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texcoord;
 
+// Depth prepass and forward pass must produce identical depths
+invariant gl_Position;
+
 uniform mat4 projection;
 uniform mat4 view;
 uniform mat4 model;
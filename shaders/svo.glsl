@@ -0,0 +1,57 @@
+// Sparse voxel octree shared by the build passes (svo*.comp) and cone tracing (vct.glsl).
+//
+// Nodes are allocated in tiles of 8 siblings, node n is child n & 7 of its parent. nodes[n] holds the tile
+// of n's children, 0 when it has none, tile 0 being the children of the implicit root at level 0. The
+// filtered value of node n is one texel of the brick pool, each tile owns a 2x2x2 brick so hardware
+// trilinear filtering interpolates between siblings.
+
+#define SVO_FLAG 0x80000000u
+#define SVO_TILE_MASK 0x7FFFFFFFu
+
+layout(std430, binding = 2) buffer NodePool {
+	uint nodes[];
+};
+
+// Leaves are svoDepth levels below the root, 2^svoDepth voxels across the cube from svoMin with sides svoSize
+uniform int svoDepth;
+uniform vec3 svoMin;
+uniform float svoSize;
+
+ivec3 svoOctant(uint child) {
+	return ivec3(child & 1u, (child >> 1) & 1u, (child >> 2) & 1u);
+}
+
+ivec3 svoBrick(uint tile, int brickDim) {
+	uint b = uint(brickDim);
+	return ivec3(tile % b, (tile / b) % b, tile / (b * b)) * 2;
+}
+
+ivec3 svoTexel(uint node, int brickDim) {
+	return svoBrick(node >> 3, brickDim) + svoOctant(node & 7u);
+}
+
+// Child of the level - 1 node containing voxel, in leaf coordinates
+uint svoChild(uvec3 voxel, int level) {
+	uvec3 bit = (voxel >> uint(svoDepth - level)) & 1u;
+	return bit.x | (bit.y << 1) | (bit.z << 2);
+}
+
+// Node at level containing voxel, -1 when a node above it has no children
+int svoFind(uvec3 voxel, int level) {
+	uint tile = 0;
+	for (int l = 1; l < level; l++) {
+		tile = nodes[tile * 8 + svoChild(voxel, l)] & SVO_TILE_MASK;
+		if (tile == 0)
+			return -1;
+	}
+	return int(tile * 8 + svoChild(voxel, level));
+}
+
+// 10 bits per axis, enough for 1024^3
+uint svoPackPosition(uvec3 voxel) {
+	return voxel.x | (voxel.y << 10) | (voxel.z << 20);
+}
+
+uvec3 svoUnpackPosition(uint packed) {
+	return uvec3(packed & 0x3FFu, (packed >> 10) & 0x3FFu, packed >> 20);
+}
@@ -0,0 +1,14 @@
+// Voxel fragment list written by voxelize.frag and read by the octree build passes. Fragments past
+// fragmentCapacity are counted but dropped, the list is then grown and the scene voxelized again.
+
+struct VoxelFragment {
+	uint position;
+	uint color;
+	uint normal;
+};
+
+layout(std430, binding = 1) buffer FragmentList {
+	uint fragmentCount;
+	uint fragmentCapacity;
+	VoxelFragment fragments[];
+};
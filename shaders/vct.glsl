@@ -0,0 +1,418 @@
+// Lighting and voxel cone tracing shared by the forward (phong.frag) and deferred (deferredShading.comp) paths.
+
+#include "shadow.glsl"
+#include "voxelStorage.glsl"
+
+uniform sampler3D voxelColor;
+// Packed octahedrally in the packed storage formats
+uniform sampler3D voxelNormal;
+uniform sampler3D voxelRadiance;
+#ifdef VOXEL_PACKED
+uniform sampler3D voxelOpacity;
+#endif
+
+uniform bool voxelize = false;
+uniform bool normals = false;
+uniform bool dominant_axis = false;
+uniform bool radiance = false;
+
+uniform bool enableShadows = true;
+uniform bool enableIndirect = false;
+uniform bool enableDiffuse = true;
+uniform bool enableSpecular = true;
+uniform float ambientScale = 0.2;
+
+uniform vec3 eye;
+uniform vec3 lightPos;
+uniform vec3 lightInt;
+
+uniform int miplevel = 0;
+// Maps world space to the dense grid's [0, 1] texture coordinates, voxels are voxelSize wide on every axis
+uniform mat4 worldToVoxel;
+uniform float voxelSize;
+
+uniform int vctSteps;
+uniform float vctConeAngle;
+uniform float vctBias;
+uniform float vctConeInitialHeight;
+uniform float vctLodOffset;
+
+// Adaptive tracing picks cone count, steps and distance per pixel within coneBudget samples
+uniform bool adaptiveCones = false;
+uniform float coneBudget = 48.0;
+// World space size of one pixel at unit distance from the eye
+uniform float pixelAngle;
+
+// Camera centered clipmap, used for cone tracing instead of the dense volume when enabled. Level l has
+// voxels clipVoxelSize * 2^l wide and covers clipDim voxels from clipOrigins[l], addressed toroidally.
+#define CLIPMAP_LEVELS 4
+uniform bool clipmap = false;
+uniform sampler3D clipRadiance[CLIPMAP_LEVELS];
+uniform ivec3 clipOrigins[CLIPMAP_LEVELS];
+uniform float clipVoxelSize;
+uniform int clipDim;
+
+// Sparse voxel octree, traced instead of the dense volume when enabled
+#include "svo.glsl"
+uniform bool svo = false;
+uniform sampler3D svoBricks;
+
+// Empty space skipping for the dense volume
+#include "occupancy.glsl"
+#include "distanceField.glsl"
+
+// Samples taken by traceCone in this invocation, summed into ConeSamples while the overlay readout is open
+uniform bool coneStats = false;
+uint coneSamples = 0;
+// Samples the same cones would have taken across the empty space they skipped
+uint coneSamplesSaved = 0;
+layout(std430, binding = 0) buffer ConeSamples {
+	uint totalSamples;
+	uint totalPixels;
+	uint totalSamplesSaved;
+};
+
+// based on https://github.com/godotengine/godot/blob/master/drivers/gles3/shaders/scene.glsl
+// experiment with cone aperture, lod scaling, steps vs distance vs alpha
+const float NO_MAX_DISTANCE = 1e30;
+
+// maxDistance is in voxels, cones also stop once they leave the volume when it is set
+vec3 traceCone(sampler3D voxelTexture, vec3 position, vec3 direction, int steps, float maxDistance) {
+	// const float bias = 1.0;
+	float bias = vctBias;
+
+	// One voxel along direction in texture coordinates
+	direction = mat3(worldToVoxel) * normalize(direction) * voxelSize;
+	vec3 start = position + bias * direction;
+	
+	float coneAngle = vctConeAngle;
+	// float coneTanHalfAngle = tan(coneAngle / 2.0);
+	vec3 dims = vec3(textureSize(voxelTexture, 0));
+
+	float coneHeight = vctConeInitialHeight;
+	float coneRadius;
+
+	vec3 color = vec3(0);
+	float alpha = 0;
+
+	for (int i = 0; i < steps && alpha < 0.95 && coneHeight < maxDistance; i++) {
+		coneRadius = coneHeight * tan(coneAngle / 2.0);
+		float lod = log2(max(1.0, 2 * coneRadius));
+		vec3 samplePosition = start + coneHeight * direction;
+		if (maxDistance < NO_MAX_DISTANCE && (any(lessThan(samplePosition, vec3(0))) || any(greaterThan(samplePosition, vec3(1)))))
+			break;
+		// Jump to where the footprint reaches the end of an empty cell or the field distance, counting the steps that would have taken
+		if (useOccupancy || useDistanceField) {
+			vec3 p = samplePosition * dims;
+			float skip = max(useOccupancy ? emptySpaceDistance(p, direction * dims) : 0.0, useDistanceField ? fieldDistance(p) : 0.0) - coneRadius;
+			if (skip > coneRadius) {
+				float skipHeight = coneHeight + skip;
+				coneSamplesSaved += uint(log(skipHeight / coneHeight) / log(1.0 + tan(coneAngle / 2.0)));
+				coneHeight = skipHeight;
+				continue;
+			}
+		}
+		vec4 sampleColor = radiance
+			? sampleRadiance(voxelTexture, voxelOpacity, samplePosition, lod + vctLodOffset)
+			: textureLod(voxelTexture, samplePosition, lod + vctLodOffset);
+		coneSamples++;
+		float a = 1 - alpha;
+		color += sampleColor.rgb * a;
+		alpha += a * sampleColor.a;
+		// color += sampleColor.rgb * sampleColor.a;
+		coneHeight += coneRadius;
+	}
+
+	return color;
+}
+
+vec3 traceCone(sampler3D voxelTexture, vec3 position, vec3 direction, int steps) {
+	return traceCone(voxelTexture, position, direction, steps, NO_MAX_DISTANCE);
+}
+
+// One voxel of margin so linear filtering never reads texels wrapped around from the other side
+bool insideClipLevel(int level, vec3 position) {
+	vec3 voxel = position / (clipVoxelSize * float(1 << level)) - vec3(clipOrigins[level]);
+	return all(greaterThanEqual(voxel, vec3(1))) && all(lessThan(voxel, vec3(clipDim - 1)));
+}
+
+vec4 sampleClipLevel(int level, vec3 position) {
+	vec3 uvw = position / (clipVoxelSize * float(1 << level) * clipDim);
+	// Sampler arrays can only be indexed with constants
+	switch (level) {
+	case 0: return textureLod(clipRadiance[0], uvw, 0);
+	case 1: return textureLod(clipRadiance[1], uvw, 0);
+	case 2: return textureLod(clipRadiance[2], uvw, 0);
+	default: return textureLod(clipRadiance[3], uvw, 0);
+	}
+}
+
+// Same marching as traceCone in world units, the level takes the place of the mip level. Cones stop
+// when they leave the coarsest level. maxDistance is in level 0 voxels.
+vec3 traceConeClipmap(vec3 position, vec3 direction, int steps, float maxDistance) {
+	direction = normalize(direction);
+	vec3 start = position + vctBias * clipVoxelSize * direction;
+
+	float coneHeight = vctConeInitialHeight * clipVoxelSize;
+	float coneRadius;
+
+	vec3 color = vec3(0);
+	float alpha = 0;
+
+	for (int i = 0; i < steps && alpha < 0.95 && coneHeight < maxDistance * clipVoxelSize; i++) {
+		coneRadius = coneHeight * tan(vctConeAngle / 2.0);
+		float lod = max(log2(max(1.0, 2 * coneRadius / clipVoxelSize)) + vctLodOffset, 0.0);
+		vec3 samplePosition = start + coneHeight * direction;
+
+		int level = int(lod);
+		while (level < CLIPMAP_LEVELS && !insideClipLevel(level, samplePosition)) {
+			level++;
+		}
+		if (level >= CLIPMAP_LEVELS)
+			break;
+
+		// Blend towards the next level like trilinear filtering between mips
+		vec4 sampleColor = sampleClipLevel(level, samplePosition);
+		if (level == int(lod) && level + 1 < CLIPMAP_LEVELS && insideClipLevel(level + 1, samplePosition)) {
+			sampleColor = mix(sampleColor, sampleClipLevel(level + 1, samplePosition), fract(lod));
+		}
+		coneSamples++;
+		float a = 1 - alpha;
+		color += sampleColor.rgb * a;
+		alpha += a * sampleColor.a;
+		coneHeight += coneRadius;
+	}
+
+	return color;
+}
+
+// Value of the node at level containing unit (the volume mapped to [0, 1]), or of the deepest node above it
+// when the branch ends, interpolated with its siblings by sampling inside their shared brick
+vec4 sampleSVO(vec3 unit, int level) {
+	uvec3 voxel = uvec3(unit * float(1 << svoDepth));
+	uint tile = 0;
+	int l = 1;
+	for (; l < level; l++) {
+		uint next = nodes[tile * 8 + svoChild(voxel, l)] & SVO_TILE_MASK;
+		if (next == 0)
+			break;
+		tile = next;
+	}
+
+	// Position in the parent in texels of its brick, kept between the texel centers so filtering stays in the brick
+	vec3 local = clamp(fract(unit * float(1 << (l - 1))) * 2.0, vec3(0.5), vec3(1.5));
+	int brickDim = textureSize(svoBricks, 0).x / 2;
+	return textureLod(svoBricks, (vec3(svoBrick(tile, brickDim)) + local) / float(2 * brickDim), 0);
+}
+
+// Same marching as traceCone in world units, the octree level takes the place of the mip level.
+// maxDistance is in leaf voxels.
+vec3 traceConeSVO(vec3 position, vec3 direction, int steps, float maxDistance) {
+	float leafSize = svoSize / float(1 << svoDepth);
+	direction = normalize(direction);
+	vec3 start = position + vctBias * leafSize * direction;
+
+	float coneHeight = vctConeInitialHeight * leafSize;
+	float coneRadius;
+
+	vec3 color = vec3(0);
+	float alpha = 0;
+
+	for (int i = 0; i < steps && alpha < 0.95 && coneHeight < maxDistance * leafSize; i++) {
+		coneRadius = coneHeight * tan(vctConeAngle / 2.0);
+		float lod = max(log2(max(1.0, 2 * coneRadius / leafSize)) + vctLodOffset, 0.0);
+		vec3 unit = (start + coneHeight * direction - svoMin) / svoSize;
+		if (any(lessThan(unit, vec3(0))) || any(greaterThanEqual(unit, vec3(1))))
+			break;
+
+		// Blend towards the coarser level like trilinear filtering between mips
+		int level = svoDepth - int(lod);
+		vec4 sampleColor = sampleSVO(unit, max(level, 1));
+		if (level > 1) {
+			sampleColor = mix(sampleColor, sampleSVO(unit, level - 1), fract(lod));
+		}
+		coneSamples++;
+		float a = 1 - alpha;
+		color += sampleColor.rgb * a;
+		alpha += a * sampleColor.a;
+		coneHeight += coneRadius;
+	}
+
+	return color;
+}
+
+vec3 voxelCoord(vec3 position) {
+	return (worldToVoxel * vec4(position, 1)).xyz;
+}
+
+vec3 postprocess(vec3 color) {
+	const float gamma = 2.2;
+	// tone map
+	color = color / (color + vec3(1));
+	// gamma correction
+	color = pow(color, vec3(1.0 / gamma));
+
+	return color;
+}
+
+vec3 traceIndirectCone(vec3 position, vec3 voxelPosition, vec3 direction, int steps, float maxDistance) {
+	if (clipmap) {
+		return traceConeClipmap(position, direction, steps, maxDistance);
+	}
+	if (svo) {
+		return traceConeSVO(position, direction, steps, maxDistance);
+	}
+	return traceCone(radiance ? voxelRadiance : voxelColor, voxelPosition, direction, steps, maxDistance);
+}
+
+// Sums the invocation's counts into ConeSamples. Subgroups add theirs up first so only one invocation of each
+// touches the buffer, the includers enable GL_KHR_shader_subgroup_arithmetic where the driver has it.
+void recordConeSamples() {
+#ifdef GL_KHR_shader_subgroup_arithmetic
+	uint samples = subgroupAdd(coneSamples);
+	uint pixels = subgroupAdd(1u);
+	uint saved = subgroupAdd(coneSamplesSaved);
+	if (subgroupElect()) {
+		atomicAdd(totalSamples, samples);
+		atomicAdd(totalPixels, pixels);
+		atomicAdd(totalSamplesSaved, saved);
+	}
+#else
+	atomicAdd(totalSamples, coneSamples);
+	atomicAdd(totalPixels, 1u);
+	atomicAdd(totalSamplesSaved, coneSamplesSaved);
+#endif
+}
+
+// One cone along the normal plus sideCones cones around it, rotated by rotation radians. Four cones
+// without rotation is the fixed set, fewer cones with a changing rotation is used for temporal accumulation.
+vec3 indirectLighting(vec3 position, vec3 geometricNormal, mat3 TBN, float rotation, int sideCones, int steps, float maxDistance) {
+	vec3 voxelPosition = voxelCoord(position);
+	vec3 indirect = vec3(0);
+	indirect += traceIndirectCone(position, voxelPosition, geometricNormal, steps, maxDistance);
+
+	const float PI = 3.14159265;
+	float coneWeight = 1.0 / sideCones;
+	for (int i = 0; i < sideCones; i++) {
+		float angle = rotation + 2.0 * PI * i / sideCones;
+		vec3 dir = normalize(TBN * vec3(0.707 * cos(angle), 0.707, 0.707 * sin(angle)));
+		indirect += coneWeight * traceIndirectCone(position, voxelPosition, dir, steps, maxDistance);
+	}
+
+	// Side cones cover the hemisphere together, without them the normal cone stands in for all of it
+	if (sideCones == 0) {
+		indirect *= 2.0;
+	}
+
+	if (coneStats) {
+		recordConeSamples();
+	}
+	coneSamples = 0;
+	coneSamplesSaved = 0;
+
+	return indirect;
+}
+
+// Spends fewer samples where the result is hard to see: pixels covering several voxels need fewer side cones
+// and shorter cones, points outside the voxel volume only get the normal cone. Steps are then fit to coneBudget.
+vec3 adaptiveIndirectLighting(vec3 position, vec3 geometricNormal, mat3 TBN, float rotation, int maxSideCones) {
+	vec3 voxelPosition = voxelCoord(position);
+	bool inside = clipmap || all(greaterThanEqual(voxelPosition, vec3(0))) && all(lessThanEqual(voxelPosition, vec3(1)));
+
+	// Pixel footprint in voxels
+	float cellSize = clipmap ? clipVoxelSize : voxelSize;
+	if (svo) {
+		cellSize = svoSize / float(1 << svoDepth);
+	}
+	float footprint = distance(eye, position) * pixelAngle / cellSize;
+
+	int sideCones = inside ? maxSideCones : 0;
+	if (footprint > 4.0) {
+		sideCones = 0;
+	}
+	else if (footprint > 1.0) {
+		sideCones = min(sideCones, 2);
+	}
+
+	// Mips above the footprint are already a blur of the whole neighbourhood, no need to go as far
+	ivec3 dims = textureSize(voxelRadiance, 0);
+	float gridDim = svo ? float(1 << svoDepth) : float(max(dims.x, max(dims.y, dims.z)));
+	float maxDistance = inside ? gridDim / max(1.0, footprint) : 0.25 * gridDim;
+	int steps = int(min(float(vctSteps), coneBudget / (1 + sideCones)));
+
+	return indirectLighting(position, geometricNormal, TBN, rotation, sideCones, max(steps, 1), maxDistance);
+}
+
+vec3 indirectLighting(vec3 position, vec3 geometricNormal, mat3 TBN, float rotation, int sideCones) {
+	if (adaptiveCones) {
+		return adaptiveIndirectLighting(position, geometricNormal, TBN, rotation, sideCones);
+	}
+	return indirectLighting(position, geometricNormal, TBN, rotation, sideCones, vctSteps, NO_MAX_DISTANCE);
+}
+
+vec3 indirectLighting(vec3 position, vec3 geometricNormal, mat3 TBN) {
+	return indirectLighting(position, geometricNormal, TBN, 0.0, 4);
+}
+
+// Indirect lighting for shade(), each includer decides where it comes from (traced here or read from a buffer)
+vec3 computeIndirect(vec3 position, vec3 geometricNormal, mat3 TBN);
+
+// Shades one surface point. position, geometricNormal and TBN are in world space, norm, light and view
+// only need to share a space (tangent space when normal mapping in the forward pass).
+vec4 shade(vec4 albedo, vec3 position, vec3 geometricNormal, mat3 TBN, vec3 norm, vec3 light, vec3 view, float shininess) {
+	vec4 color = albedo;
+
+    vec3 h = normalize(view + light);
+
+    float ambient = ambientScale;
+    float diffuse = max(dot(norm, light), 0);
+    float specular = pow(max(dot(norm, h), 0), shininess);
+
+	float shadowFactor = 1.0;
+	if (enableShadows) {
+		shadowFactor = 1.0 - calcShadowFactor(position);
+	}
+
+    if (voxelize) {
+		vec3 i = voxelCoord(position);
+		
+		if (normals) {
+			vec3 normal = normalize(unpackVoxelNormal(textureLod(voxelNormal, i, miplevel)));
+			color = vec4(normal, 1);
+		}
+		else if (radiance) {
+			color = sampleRadiance(voxelRadiance, voxelOpacity, i, miplevel);
+		}
+		else {
+			color = textureLod(voxelColor, i, miplevel).rgba;			
+		}
+    }
+    else {
+        if (normals) {
+			color = vec4(norm, 1);
+        }
+        else if (dominant_axis) {
+            norm = abs(norm);
+            color = vec4(step(vec3(max(max(norm.x, norm.y), norm.z)), norm.xyz), 1);
+        }
+        else {
+			float directLighting = 0.0;
+			directLighting += enableDiffuse ? diffuse : 0.0;
+			directLighting += enableSpecular ? specular : 0.0;
+			
+			if (enableIndirect) {
+				vec3 indirect = computeIndirect(position, geometricNormal, TBN);
+				indirect *= ambientScale;
+				indirect *= color.rgb;
+				color = vec4(indirect + shadowFactor * directLighting * lightInt * color.rgb, 1);
+			}
+			else {
+				color = vec4((ambient + shadowFactor * directLighting) * lightInt * color.rgb, 1);
+			}
+
+			// color.rgb = postprocess(color.rgb);
+        }
+    }
+
+	return color;
+}
@@ -0,0 +1,26 @@
+// Occupied voxels and 4^3 bricks of the dense grid, appended by buildOccupancy.comp. The first three words of
+// each list are the indirect dispatch size at VOXEL_LIST_GROUP_SIZE voxels or BRICK_LIST_GROUP_SIZE bricks
+// per workgroup. Bricks are packed the same way as voxels, in brick coordinates.
+
+#define VOXEL_LIST_GROUP_SIZE 64
+#define BRICK_LIST_GROUP_SIZE 8
+
+layout(std430, binding = 6) buffer VoxelList {
+	uint listGroupsX, listGroupsY, listGroupsZ;
+	uint voxelCount;
+	uint voxels[];
+};
+
+layout(std430, binding = 7) buffer BrickList {
+	uint brickGroupsX, brickGroupsY, brickGroupsZ;
+	uint brickCount;
+	uint bricks[];
+};
+
+uint packVoxel(ivec3 voxel) {
+	return uint(voxel.x) | (uint(voxel.y) << 10) | (uint(voxel.z) << 20);
+}
+
+ivec3 unpackVoxel(uint packed) {
+	return ivec3(packed & 0x3FFu, (packed >> 10) & 0x3FFu, packed >> 20);
+}
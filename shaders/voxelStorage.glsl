@@ -0,0 +1,73 @@
+// Storage formats of the dense grid, VOXEL_STORAGE is defined by Application::setVoxelStorage. 0 keeps RGBA8
+// radiance and the voxel normals as they are. 1 and 2 store RGB10A2 or R11G11B10F radiance with its opacity in a
+// separate R8 texture of the same levels, and normals octahedral in two 8 bit channels.
+// Includers reading normals define voxelLayout first.
+
+#ifndef VOXEL_STORAGE
+#define VOXEL_STORAGE 0
+#endif
+
+#if VOXEL_STORAGE == 1
+#define radianceLayout rgb10_a2
+#elif VOXEL_STORAGE == 2
+#define radianceLayout r11f_g11f_b10f
+#else
+#define radianceLayout rgba8
+#endif
+
+#if VOXEL_STORAGE != 0
+#define VOXEL_PACKED 1
+#define normalLayout rg8
+#else
+#define normalLayout voxelLayout
+#endif
+
+vec2 octEncode(vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 p = n.xy;
+	if (n.z < 0.0) {
+		p = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return p;
+}
+
+vec3 octDecode(vec2 p) {
+	vec3 n = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+// Octahedral coordinates in 1 to 255 of each unorm channel, 0 is left for voxels without a normal
+vec4 packVoxelNormal(vec3 n) {
+	if (dot(n, n) == 0.0)
+		return vec4(0);
+	return vec4((octEncode(n) * 0.5 + 0.5) * (254.0 / 255.0) + 1.0 / 255.0, 0, 0);
+}
+
+#ifdef VOXEL_PACKED
+vec3 unpackVoxelNormal(vec4 v) {
+	if (v.x < 0.5 / 255.0)
+		return vec3(0);
+	return octDecode(((v.xy - 1.0 / 255.0) * (255.0 / 254.0)) * 2.0 - 1.0);
+}
+
+// Radiance is premultiplied by its opacity through the mips, so samples with no opacity skip the radiance fetch
+vec4 sampleRadiance(sampler3D radiance, sampler3D opacity, vec3 p, float lod) {
+	float a = textureLod(opacity, p, lod).r;
+	return a > 0.0 ? vec4(textureLod(radiance, p, lod).rgb, a) : vec4(0);
+}
+
+#define loadRadiance(radiance, opacity, p) vec4(imageLoad(radiance, p).rgb, imageLoad(opacity, p).r)
+#define storeRadiance(radiance, opacity, p, value) { vec4 v_ = (value); imageStore(radiance, p, v_); imageStore(opacity, p, v_.aaaa); }
+#else
+vec3 unpackVoxelNormal(vec4 v) {
+	return v.xyz;
+}
+
+// The opacity arguments name images and samplers that only exist in the packed formats
+#define sampleRadiance(radiance, opacity, p, lod) textureLod(radiance, p, lod)
+#define loadRadiance(radiance, opacity, p) imageLoad(radiance, p)
+#define storeRadiance(radiance, opacity, p, value) imageStore(radiance, p, value)
+#endif
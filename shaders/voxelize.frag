@@ -6,6 +6,7 @@
 
 in GS_OUT {
     vec3 position;
+    vec3 worldPosition;
     vec3 normal;
     vec2 texcoord;
     flat int axis;
@@ -23,33 +24,34 @@ layout(binding = 0) uniform sampler2D diffuseTexture;
 
 uniform vec3 eye, lightPos, lightInt;
 
-// Map [-1, 1] -> [0, 1]
-vec3 ndcToUnit(vec3 p) { return (p + 1.0) * 0.5; }
+// Clipmap levels are addressed by world voxel coordinate wrapped to the texture size, only fragments
+// in the region being updated, [regionMin, regionMax) in voxels of clipVoxelSize, are written
+uniform bool clipmap = false;
+uniform float clipVoxelSize;
+uniform ivec3 regionMin, regionMax;
 
-ivec3 getVoxelPosition() {
-	// get ndc
-	vec3 ndc = vec3(fs_in.position);
-
-	// map to unit
-	vec3 unit = ndcToUnit(ndc);
+#include "svo.glsl"
+#include "svoFragments.glsl"
+#include "morton.glsl"
 
-	// swizzle based on projected axis
-	if (fs_in.axis == 0) {
-		// looking down x axis
-		unit = vec3(1 - unit.z, unit.y, unit.x);
-	}
-	else if (fs_in.axis == 1) {
-		// looking down y axis
-		unit = vec3(unit.x, 1 - unit.z, unit.y);
-	}
-	else {
-		// looking down z axis
-	}
+// Appends fragments to the octree's fragment list instead of writing the voxel textures
+uniform bool fragmentList = false;
+// Appends dense grid fragments keyed by the Morton code of their voxel to the fragment list, sorted and
+// averaged by VoxelFragmentSort. The voxel textures are only bound for their size.
+uniform bool sortedFragments = false;
+// Without fp16 atomics, average through a compare and swap loop instead of keeping the maximum
+uniform bool averageAtomics = false;
 
-	// map to voxel index
-	vec3 voxelIndex = unit * imageSize(voxelColor).x;
+// Maps world space to the dense grid's [0, 1] texture coordinates
+uniform mat4 worldToVoxel;
 
-	return ivec3(voxelIndex);
+// Voxels outside the grid are -1
+ivec3 getVoxelPosition() {
+	ivec3 size = imageSize(voxelColor);
+	ivec3 voxel = ivec3(floor((worldToVoxel * vec4(fs_in.worldPosition, 1)).xyz * vec3(size)));
+	if (any(lessThan(voxel, ivec3(0))) || any(greaterThanEqual(voxel, size)))
+		return ivec3(-1);
+	return voxel;
 }
 
 // From OpenGL Insights
@@ -69,37 +71,87 @@ uint convVec4ToRGBA8(vec4 val) {
 		| (uint(val.x) & 0x000000FF);
 }
 
-// void imageAtomicRGBA8Avg(layout(r32ui) coherent volatile uimage3D imgUI, ivec3 coords, vec4 val) {
-// 	val.rgb *= 255.0;
-// 	uint newVal = convVec4ToRGBA8(val);
-// 	uint prevStoredVal = 0, curStoredVal;
-// 	while ((curStoredVal = imageAtomicCompSwap(imgUI, coords, prevStoredVal, newVal)) != prevStoredVal) {
-// 		prevStoredVal = curStoredVal;
-// 		vec4 rval = convRGBA8ToVec4(curStoredVal);
-// 		rval.xyz *= rval.w;
-// 		vec4 curValF = rval + val;
-// 		curValF.xyz /= curValF.w;
-// 		newVal = convVec4ToRGBA8(curValF);
-// 	}
-// }
+#if !GL_NV_shader_atomic_fp16_vector
+// Running average with the count in alpha. Each retry means another fragment of the voxel got in first,
+// so under heavy contention the loop gives up after a bounded number of tries and drops the fragment.
+#define MAX_AVERAGE_TRIES 64
+
+void imageAtomicRGBA8Avg(ivec3 coords, vec4 val, bool normal) {
+	val.rgb *= 255.0;
+	uint newVal = convVec4ToRGBA8(val);
+	uint prevStoredVal = 0, curStoredVal;
+	for (int i = 0; i < MAX_AVERAGE_TRIES; i++) {
+		curStoredVal = normal ? imageAtomicCompSwap(voxelNormal, coords, prevStoredVal, newVal)
+			: imageAtomicCompSwap(voxelColor, coords, prevStoredVal, newVal);
+		if (curStoredVal == prevStoredVal)
+			break;
+		prevStoredVal = curStoredVal;
+		vec4 rval = convRGBA8ToVec4(curStoredVal);
+		rval.xyz *= rval.w;
+		vec4 curValF = rval + val;
+		curValF.xyz /= curValF.w;
+		newVal = convVec4ToRGBA8(curValF);
+	}
+}
+#endif
 
 void main() {
-	ivec3 voxelIndex = getVoxelPosition();
-
     vec3 color = texture(diffuseTexture, fs_in.texcoord).rgb;
 
 	vec3 normal = normalize(fs_in.normal);
 	vec3 light = normalize(lightPos - fs_in.position);
 	// color *= max(dot(normal, light), 0) * lightInt;
 
+	if (fragmentList) {
+		ivec3 voxel = ivec3(floor((fs_in.worldPosition - svoMin) / svoSize * float(1 << svoDepth)));
+		if (any(lessThan(voxel, ivec3(0))) || any(greaterThanEqual(voxel, ivec3(1 << svoDepth))))
+			discard;
+		uint index = atomicAdd(fragmentCount, 1u);
+		if (index < fragmentCapacity) {
+			fragments[index] = VoxelFragment(svoPackPosition(uvec3(voxel)), packUnorm4x8(vec4(color, 1)), packSnorm4x8(vec4(normal, 0)));
+		}
+		return;
+	}
+
+	if (sortedFragments) {
+		ivec3 voxel = getVoxelPosition();
+		if (voxel.x < 0)
+			discard;
+		uint index = atomicAdd(fragmentCount, 1u);
+		if (index < fragmentCapacity) {
+			fragments[index] = VoxelFragment(mortonEncode(uvec3(voxel)), packUnorm4x8(vec4(color, 1)), packSnorm4x8(vec4(normal, 0)));
+		}
+		return;
+	}
+
+	ivec3 voxelIndex;
+	if (clipmap) {
+		ivec3 voxel = ivec3(floor(fs_in.worldPosition / clipVoxelSize));
+		if (any(lessThan(voxel, regionMin)) || any(greaterThanEqual(voxel, regionMax)))
+			discard;
+		ivec3 size = imageSize(voxelColor);
+		// % is undefined for negative operands
+		voxelIndex = voxel - size * ivec3(floor(vec3(voxel) / vec3(size)));
+	}
+	else {
+		voxelIndex = getVoxelPosition();
+		// The projection covers a cube, non-cubic grids are shorter on some axes
+		if (voxelIndex.x < 0)
+			discard;
+	}
+
     // Store value (must be atomic, use alpha component as count)
 #if GL_NV_shader_atomic_fp16_vector
     imageAtomicAdd(voxelColor, voxelIndex, f16vec4(color, 1));
     imageAtomicAdd(voxelNormal, voxelIndex, f16vec4(normal, 1));
 #else
-	// imageAtomicRGBA8Avg(voxelColor, voxelIndex, vec4(color, 1));
-	// imageAtomicRGBA8Avg(voxelNormal, voxelIndex, vec4(normal, 1));
-	imageAtomicMax(voxelColor, voxelIndex, convVec4ToRGBA8(255 * vec4(color, 1)));
-	imageAtomicMax(voxelNormal, voxelIndex, convVec4ToRGBA8(255 * vec4(normal, 1)));
+	if (averageAtomics) {
+		imageAtomicRGBA8Avg(voxelIndex, vec4(color, 1), false);
+		imageAtomicRGBA8Avg(voxelIndex, vec4(normal, 1), true);
+	}
+	else {
+		imageAtomicMax(voxelColor, voxelIndex, convVec4ToRGBA8(255 * vec4(color, 1)));
+		imageAtomicMax(voxelNormal, voxelIndex, convVec4ToRGBA8(255 * vec4(normal, 1)));
+	}
 #endif
 }
@@ -0,0 +1,35 @@
+#version 430 core
+
+// Voxelization without the geometry shader. Static triangles are binned by their world space dominant axis when
+// their node is added, see Mesh::binAxes, and each bin is drawn with the projection along its axis.
+
+layout (location = 0) in vec3 vertPosition;
+layout (location = 1) in vec3 vertNormal;
+layout (location = 2) in vec2 vertTexcoord;
+
+// Named as voxelize.geom's output so voxelize.frag links against either
+out GS_OUT {
+    vec3 position;
+    vec3 worldPosition;
+    vec3 normal;
+    vec2 texcoord;
+    flat int axis;
+} vs_out;
+
+uniform mat4 model;
+// Projection along the axis of the bin being drawn
+uniform mat4 mvp;
+uniform int axis;
+
+void main() {
+    vec4 worldPosition = model * vec4(vertPosition, 1.0);
+    gl_Position = mvp * worldPosition;
+
+    mat3 normalMatrix = mat3(transpose(inverse(model)));
+
+    vs_out.position = gl_Position.xyz;
+    vs_out.worldPosition = worldPosition.xyz;
+    vs_out.normal = normalMatrix * vertNormal;
+    vs_out.texcoord = vertTexcoord;
+    vs_out.axis = axis;
+}
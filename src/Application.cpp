@@ -12,9 +12,16 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <map>
 
 #include "Graphics/GLHelper.h"
 #include "Graphics/GLShaderProgram.h"
+#include "Graphics/GLShaderCompiler.h"
 #include "Graphics/GLQuad.h"
 #include "Graphics/GLTimer.h"
 
@@ -24,13 +31,27 @@
 #include "Overlay.h"
 #include "Camera.h"
 #include "Scene.h"
+#include "CPU/CPUMipPyramid.h"
 
 #include "common.h"
 
-#define SHADOWMAP_WIDTH 4096
-#define SHADOWMAP_HEIGHT 4096
+// The clipmap keeps a fixed size, its voxels start at the dense grid's size
+#define CLIPMAP_DIM 128
 
-GLuint make3DTexture(GLsizei size, GLsizei levels, GLenum internalFormat, GLint minFilter, GLint magFilter);
+// Cached cascades cover this much more than their frustum slice, see fitShadowCascades
+#define SHADOW_CACHE_MARGIN 1.25f
+
+// 4M nodes
+#define OCTREE_TILE_CAPACITY (1 << 19)
+
+// Longest voxel and brick lists one indirect dispatch of VOXEL_LIST_GROUP_SIZE and BRICK_LIST_GROUP_SIZE wide
+// groups covers, see voxelList.glsl
+#define MAX_LISTED_VOXELS (65535u * 64u)
+#define MAX_LISTED_BRICKS (65535u * 8u)
+
+static const glm::vec3 CLEAR_COLOR {0.5294f, 0.8078f, 0.9216f};
+
+GLuint make3DTexture(const glm::ivec3 &size, GLsizei levels, GLenum internalFormat, GLint minFilter, GLint magFilter);
 
 void view2DTexture(GLuint texture);
 
@@ -38,54 +59,151 @@ void Application::init() {
 	// Setup for OpenGL
 	glfwGetFramebufferSize(window, &width, &height);
 	glViewport(0, 0, width, height);
-	glClearColor(0.5294f, 0.8078f, 0.9216f, 1.0f);
+	glClearColor(CLEAR_COLOR.x, CLEAR_COLOR.y, CLEAR_COLOR.z, 1.0f);
 	
 	// Setup framebuffers
-	shadowmapFBO.bind();
-	glm::vec4 borderColor{ 1.0f };
-	shadowmapFBO.attachTexture(
-		GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT,
-		SHADOWMAP_WIDTH, SHADOWMAP_HEIGHT,
-		GL_DEPTH_COMPONENT, GL_FLOAT,
-		GL_LINEAR, GL_LINEAR,
-		GL_CLAMP_TO_BORDER, GL_CLAMP_TO_BORDER,
-		&borderColor
-	);
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
-	if (shadowmapFBO.getStatus() != GL_FRAMEBUFFER_COMPLETE) {
-		LOG_ERROR("shadowmapFBO not created successfully");
+	allocateShadowmaps(settings.shadowmapSize);
+
+	gbufferFBO.bind();
+	gbufferFBO.attachTexture(GL_COLOR_ATTACHMENT0, GL_RGBA8, width, height, GL_RGBA, GL_UNSIGNED_BYTE);
+	gbufferFBO.attachTexture(GL_COLOR_ATTACHMENT1, GL_RGBA16F, width, height, GL_RGBA, GL_FLOAT);
+	gbufferFBO.attachTexture(GL_COLOR_ATTACHMENT2, GL_RGBA16F, width, height, GL_RGBA, GL_FLOAT);
+	gbufferFBO.attachTexture(GL_COLOR_ATTACHMENT3, GL_RGBA16F, width, height, GL_RGBA, GL_FLOAT);
+	gbufferFBO.attachTexture(GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT32F, width, height, GL_DEPTH_COMPONENT, GL_FLOAT);
+	const GLenum gbufferAttachments[] = {
+		GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3
+	};
+	glDrawBuffers(4, gbufferAttachments);
+	if (gbufferFBO.getStatus() != GL_FRAMEBUFFER_COMPLETE) {
+		LOG_ERROR("gbufferFBO not created successfully");
 	}
-	shadowmapFBO.unbind();
+	gbufferFBO.unbind();
+
+	deferredFBO.bind();
+	deferredFBO.attachTexture(GL_COLOR_ATTACHMENT0, GL_RGBA8, width, height, GL_RGBA, GL_UNSIGNED_BYTE);
+	if (deferredFBO.getStatus() != GL_FRAMEBUFFER_COMPLETE) {
+		LOG_ERROR("deferredFBO not created successfully");
+	}
+	deferredFBO.unbind();
 
-	// Create shaders
-	program.attachAndLink({SHADER_DIR "phong.vert", SHADER_DIR "phong.frag"});
+	// Full size so the scale can change at runtime, reduced resolution passes only use the top left corner
+	indirectFBO.bind();
+	indirectFBO.attachTexture(GL_COLOR_ATTACHMENT0, GL_RGBA16F, width, height, GL_RGBA, GL_FLOAT);
+	if (indirectFBO.getStatus() != GL_FRAMEBUFFER_COMPLETE) {
+		LOG_ERROR("indirectFBO not created successfully");
+	}
+	indirectFBO.unbind();
+
+	// Ping-ponged indirect light history for temporal accumulation
+	historyFBO.bind();
+	historyFBO.attachTexture(GL_COLOR_ATTACHMENT0, GL_RGBA16F, width, height, GL_RGBA, GL_FLOAT, GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+	historyFBO.attachTexture(GL_COLOR_ATTACHMENT1, GL_RGBA16F, width, height, GL_RGBA, GL_FLOAT, GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+	if (historyFBO.getStatus() != GL_FRAMEBUFFER_COMPLETE) {
+		LOG_ERROR("historyFBO not created successfully");
+	}
+	historyFBO.unbind();
+
+	// Submit shaders up front, they compile in the background while the scene loads and are
+	// joined the first time each program is used
+	auto startupStart = std::chrono::high_resolution_clock::now();
+	GLShaderCompiler::init(window);
+	setVoxelStorage(settings.voxelStorage);
+	program.attachAndLinkAsync({SHADER_DIR "phong.vert", SHADER_DIR "phong.frag"});
 	program.setObjectLabel("Phong");
-	voxelProgram.attachAndLink({SHADER_DIR "voxelize.vert", SHADER_DIR "voxelize.frag", SHADER_DIR "voxelize.geom"});
+	voxelProgram.attachAndLinkAsync({SHADER_DIR "voxelize.vert", SHADER_DIR "voxelize.frag", SHADER_DIR "voxelize.geom"});
 	voxelProgram.setObjectLabel("Voxelize");
-	shadowmapProgram.attachAndLink({SHADER_DIR "simple.vert", SHADER_DIR "empty.frag"});
+	voxelAxisProgram.attachAndLinkAsync({SHADER_DIR "voxelizeAxis.vert", SHADER_DIR "voxelize.frag"});
+	voxelAxisProgram.setObjectLabel("Voxelize Axis Binned");
+	shadowmapProgram.attachAndLinkAsync({SHADER_DIR "simple.vert", SHADER_DIR "empty.frag"});
 	shadowmapProgram.setObjectLabel("Shadowmap");
-	injectRadianceProgram.attachAndLink({SHADER_DIR "injectRadiance.comp"});
+	normalizeProgram.attachAndLinkAsync({SHADER_DIR "normalizeVoxels.comp"});
+	normalizeProgram.setObjectLabel("Normalize Voxels");
+	injectRadianceProgram.attachAndLinkAsync({SHADER_DIR "injectRadiance.comp"});
 	injectRadianceProgram.setObjectLabel("Inject Radiance");
-	mipmapProgram.attachAndLink({SHADER_DIR "filterRadiance.comp"});
+	buildOccupancyProgram.attachAndLinkAsync({SHADER_DIR "buildOccupancy.comp"});
+	buildOccupancyProgram.setObjectLabel("Build Occupancy");
+	distanceFieldProgram.attachAndLinkAsync({SHADER_DIR "distanceField.comp"});
+	distanceFieldProgram.setObjectLabel("Distance Field");
+	injectClipmapProgram.attachAndLinkAsync({SHADER_DIR "injectClipmap.comp"});
+	injectClipmapProgram.setObjectLabel("Inject Clipmap");
+	injectVoxelsProgram.attachAndLinkAsync({SHADER_DIR "injectVoxels.comp"});
+	injectVoxelsProgram.setObjectLabel("Inject Voxels");
+	filterBricksProgram.attachAndLinkAsync({SHADER_DIR "filterRadianceBricks.comp"});
+	filterBricksProgram.setObjectLabel("Filter Radiance Bricks");
+	clearBricksProgram.attachAndLinkAsync({SHADER_DIR "clearBricks.comp"});
+	clearBricksProgram.setObjectLabel("Clear Bricks");
+	packNormalsProgram.attachAndLinkAsync({SHADER_DIR "packNormals.comp"});
+	packNormalsProgram.setObjectLabel("Pack Normals");
+	octree.loadPrograms();
+	fragmentSort.loadPrograms();
+	computeVoxelizer.loadPrograms();
+	mipmapProgram.attachAndLinkAsync({SHADER_DIR "filterRadiance.comp"});
 	mipmapProgram.setObjectLabel("Filter Radiance");
+	mipmapSinglePassProgram.attachAndLinkAsync({SHADER_DIR "filterRadianceSinglePass.comp"});
+	mipmapSinglePassProgram.setObjectLabel("Filter Radiance Single Pass");
+	raymarchProgram.attachAndLinkAsync({SHADER_DIR "quad.vert", SHADER_DIR "raymarch.frag"});
+	raymarchProgram.setObjectLabel("Raymarch");
+	gbufferProgram.attachAndLinkAsync({SHADER_DIR "phong.vert", SHADER_DIR "gbuffer.frag"});
+	gbufferProgram.setObjectLabel("G-Buffer");
+	indirectLightingProgram.attachAndLinkAsync({SHADER_DIR "indirectLighting.comp"});
+	indirectLightingProgram.setObjectLabel("Indirect Lighting");
+	temporalIndirectProgram.attachAndLinkAsync({SHADER_DIR "temporalIndirect.comp"});
+	temporalIndirectProgram.setObjectLabel("Temporal Indirect");
+	deferredShadingProgram.attachAndLinkAsync({SHADER_DIR "deferredShading.comp"});
+	deferredShadingProgram.setObjectLabel("Deferred Shading");
+
+	programs = {
+		&program, &voxelProgram, &voxelAxisProgram, &shadowmapProgram, &normalizeProgram, &injectRadianceProgram, &mipmapProgram,
+		&raymarchProgram, &gbufferProgram, &indirectLightingProgram, &temporalIndirectProgram,
+		&deferredShadingProgram, &injectClipmapProgram, &mipmapSinglePassProgram,
+		&buildOccupancyProgram, &distanceFieldProgram, &injectVoxelsProgram,
+		&filterBricksProgram, &clearBricksProgram, &packNormalsProgram
+	};
+	for (GLShaderProgram *p : octree.getPrograms()) {
+		programs.push_back(p);
+	}
+	for (GLShaderProgram *p : fragmentSort.getPrograms()) {
+		programs.push_back(p);
+	}
+	for (GLShaderProgram *p : computeVoxelizer.getPrograms()) {
+		programs.push_back(p);
+	}
+	auto pollShaders = [this]() {
+		int ready = 0;
+		for (GLShaderProgram *p : programs) {
+			ready += p->poll() ? 1 : 0;
+		}
+		return ready;
+	};
+	auto shadersSubmitted = std::chrono::high_resolution_clock::now();
+
+	const GLuint zero = 0;
+	const GLuint zeros[3] = { 0, 0, 0 };
+	glCreateBuffers(CONE_SAMPLE_BUFFERS, coneSampleBuffers);
+	for (int i = 0; i < CONE_SAMPLE_BUFFERS; i++) {
+		const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glNamedBufferStorage(coneSampleBuffers[i], sizeof(zeros), zeros, flags | GL_DYNAMIC_STORAGE_BIT);
+		coneSampleCounts[i] = (const GLuint *)glMapNamedBufferRange(coneSampleBuffers[i], 0, sizeof(zeros), flags);
+	}
+	glCreateBuffers(1, &mipCounterBuffer);
+	glNamedBufferStorage(mipCounterBuffer, sizeof(GLuint), &zero, 0);
+	glCreateBuffers(1, &voxelListStats);
+	glNamedBufferStorage(voxelListStats, 2 * sizeof(GLuint), nullptr, 0);
 
-	// Initialize voxel textures
+	// Voxel textures are sized to the scene, see updateVoxelGrid
 	useRGBA16f = GLAD_GL_NV_shader_atomic_fp16_vector;
-	GLenum voxelFormat = useRGBA16f ? GL_RGBA16F : GL_RGBA8;
-	// voxelColor = make3DTexture(voxelDim, 4, voxelFormat, GL_LINEAR_MIPMAP_LINEAR, GL_NEAREST);
-	voxelColor = make3DTexture(voxelDim, 1, voxelFormat, GL_LINEAR, GL_NEAREST);
-	voxelNormal = make3DTexture(voxelDim, 1, voxelFormat, GL_NEAREST, GL_NEAREST);
-	voxelRadiance = make3DTexture(voxelDim, voxelLevels, GL_RGBA8, GL_LINEAR_MIPMAP_LINEAR, GL_NEAREST);
 
 	// Create scene
 	scene = std::make_unique<Scene>();
 	scene->addMesh(RESOURCE_DIR "sponza2/sponza.obj", glm::scale(glm::mat4(1.0f), glm::vec3(0.01f)));
-	scene->addMesh(RESOURCE_DIR "nanosuit/nanosuit.obj", glm::scale(glm::mat4(1.0f), glm::vec3(0.25f)));
+	pollShaders();
+	// Dynamic, so moving it only re-voxelizes the voxels it covers and redraws it over the cached static shadows
+	nanosuitNode = scene->addMesh(RESOURCE_DIR "nanosuit/nanosuit.obj", glm::scale(glm::mat4(1.0f), glm::vec3(0.25f)), true);
 	// scene->addMesh(RESOURCE_DIR "cube.obj");
 	// scene->addMesh(RESOURCE_DIR "cube.obj", glm::translate(glm::scale(glm::mat4(), glm::vec3(5)), glm::vec3(0,-2,0)));
 	// scene->addMesh(RESOURCE_DIR "sphere.obj", glm::translate(glm::mat4(), glm::vec3(2.5,0,0)));
 	scene->setMainlight({12.0f, 40.0f, -7.0f}, {-0.38f, -0.88f, 0.2f}, {1.0f, 1.0f, 1.0f});
+	updateVoxelGrid();
 
 	// Camera setup
 	camera.position = glm::vec3(5, 1, 0);
@@ -93,6 +211,17 @@ void Application::init() {
 	camera.update(0.0f);
 
     GLQuad::init();
+
+	auto assetsLoaded = std::chrono::high_resolution_clock::now();
+	int ready = pollShaders();
+	std::chrono::duration<double> submitTime = shadersSubmitted - startupStart;
+	std::chrono::duration<double> loadTime = assetsLoaded - shadersSubmitted;
+	LOG_INFO(
+		"\n\tStartup timeline",
+		"\n\tshaders submitted in ", submitTime.count(), " seconds",
+		"\n\tassets loaded in     ", loadTime.count(), " seconds",
+		"\n\tprograms ready       ", ready, " / ", (int)programs.size()
+	);
 }
 
 void Application::update(float dt) {
@@ -115,6 +244,34 @@ void Application::update(float dt) {
 		settings.drawVoxels = !settings.drawVoxels;
 	}
 
+	// Walks the nanosuit in a circle around where it was loaded, facing along the path
+	if (settings.animateNanosuit) {
+		nanosuitAngle += 0.5f * dt;
+		glm::mat4 model = glm::translate(glm::mat4(1.0f), 2.0f * glm::vec3(std::cos(nanosuitAngle), 0.0f, std::sin(nanosuitAngle)));
+		model = glm::rotate(model, -nanosuitAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+		scene->setTransform(nanosuitNode, glm::scale(model, glm::vec3(0.25f)));
+	}
+
+	// Hot reload shaders whose source or includes changed on disk. Programs that are still
+	// compiling are picked up once they are first used.
+	for (GLShaderProgram *p : programs) {
+		if (p->poll()) {
+			for (const auto &file : p->getDependencies()) {
+				shaderWatcher.watch(file);
+			}
+		}
+	}
+	for (const auto &file : shaderWatcher.poll()) {
+		for (GLShaderProgram *p : programs) {
+			if (p->dependsOn(file)) {
+				p->reload();
+				voxelsDirty = true;
+				clipmapDirty = true;
+				octreeDirty = true;
+			}
+		}
+	}
+
 	if (GLFW_CURSOR_DISABLED == glfwGetInputMode(window, GLFW_CURSOR)) {
 		camera.update(dt);
 	}
@@ -126,85 +283,234 @@ void Application::render(float dt) {
 
 	Light mainlight = scene->getMainlight();
 	
-	voxelizeTimer.start();
-	// Voxelize scene
-	{
-		GL_DEBUG_PUSH("Voxelize Scene")
-		glViewport(0, 0, voxelDim, voxelDim);
-		glDisable(GL_DEPTH_TEST);
-		glDisable(GL_CULL_FACE);
-		glDepthMask(GL_FALSE);
-		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-		if (GLAD_GL_NV_conservative_raster && settings.conservativeRasterization) {
-			glEnable(GL_CONSERVATIVE_RASTERIZATION_NV);
+	// Each GI pass only re-runs when something it reads changed: voxels depend on geometry and voxelization
+	// settings, radiance on the voxels and the light, mips on the radiance
+	if (!settings.skipUnchangedGI) {
+		voxelsDirty = true;
+		clipmapDirty = true;
+		octreeDirty = true;
+	}
+	if (settings.voxelStorage != voxelStorage) {
+		setVoxelStorage(settings.voxelStorage);
+	}
+	if (updateVoxelGrid()) {
+		voxelsDirty = true;
+		octreeDirty = true;
+	}
+	if (scene->getStaticVersion() != giInputs.staticVersion
+		|| settings.axisOverride != giInputs.axisOverride
+		|| settings.conservativeRasterization != giInputs.conservativeRasterization) {
+		giInputs.staticVersion = scene->getStaticVersion();
+		giInputs.axisOverride = settings.axisOverride;
+		giInputs.conservativeRasterization = settings.conservativeRasterization;
+		voxelsDirty = true;
+		clipmapDirty = true;
+		octreeDirty = true;
+	}
+	bool dynamicVoxelsDirty = scene->getVersion() != giInputs.sceneVersion;
+	giInputs.sceneVersion = scene->getVersion();
+	if (mainlight.position != giInputs.light.position
+		|| mainlight.direction != giInputs.light.direction
+		|| mainlight.intensity != giInputs.light.intensity) {
+		giInputs.light = mainlight;
+		radianceDirty = true;
+	}
+	// Released after packing with voxelNormal, see settings.dropVoxelNormal. The static normals are gone, so the
+	// static grid has to be voxelized again before anything is copied from it.
+	if (!staticVoxelNormal && (voxelsDirty || dynamicVoxelsDirty)) {
+		staticVoxelNormal = make3DTexture(voxelDims, 1, useRGBA16f ? GL_RGBA16F : GL_RGBA8, GL_NEAREST, GL_NEAREST);
+		voxelsDirty = true;
+	}
+	// Region of the grid to rebuild from the static grid plus dynamic nodes, the whole grid when static
+	// voxels changed, otherwise only the voxels dynamic nodes cover now or covered last time
+	glm::ivec3 regionMin(voxelDims), regionMax(0);
+	if (voxelsDirty) {
+		regionMin = glm::ivec3(0);
+		regionMax = voxelDims;
+	}
+	else if (dynamicVoxelsDirty) {
+		regionMin = glm::min(dynamicVoxelMin, regionMin);
+		regionMax = glm::max(dynamicVoxelMax, regionMax);
+	}
+	if (voxelsDirty || dynamicVoxelsDirty) {
+		dynamicVoxelMin = voxelDims;
+		dynamicVoxelMax = glm::ivec3(0);
+		if (scene->hasDynamicNodes()) {
+			glm::vec3 dynamicMin, dynamicMax;
+			scene->getBounds(dynamicMin, dynamicMax, Scene::Filter::Dynamic);
+			worldToVoxelBounds(dynamicMin, dynamicMax, dynamicVoxelMin, dynamicVoxelMax);
 		}
+		regionMin = glm::min(regionMin, dynamicVoxelMin);
+		regionMax = glm::max(regionMax, dynamicVoxelMax);
+	}
+	// The clipmap and octree replace the dense grid
+	bool denseVoxels = !settings.clipmap && !settings.sparseOctree;
+	bool rebuildRegion = denseVoxels && glm::all(glm::lessThan(regionMin, regionMax));
+	voxelizeSkipped = !rebuildRegion;
+	// Released after packing, see settings.dropVoxelNormal
+	if (rebuildRegion && !voxelNormal) {
+		voxelNormal = make3DTexture(voxelDims, 1, useRGBA16f ? GL_RGBA16F : GL_RGBA8, GL_NEAREST, GL_NEAREST);
+	}
 
-		glClearTexImage(voxelColor, 0, GL_RGBA, GL_FLOAT, nullptr);
-		glClearTexImage(voxelNormal, 0, GL_RGBA, GL_FLOAT, nullptr);
-
-		glm::mat4 projection = glm::ortho(-20.0f, 20.0f, -20.0f, 20.0f, 0.0f, 40.0f);
-		glm::mat4 mvp_x = projection * glm::lookAt(glm::vec3(20, 0, 0), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-		glm::mat4 mvp_y = projection * glm::lookAt(glm::vec3(0, 20, 0), glm::vec3(0, 0, 0), glm::vec3(0, 0, -1));
-		glm::mat4 mvp_z = projection * glm::lookAt(glm::vec3(0, 0, 20), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-
-		voxelProgram.bind();
-		voxelProgram.setUniformMatrix4fv("mvp_x", mvp_x);
-		voxelProgram.setUniformMatrix4fv("mvp_y", mvp_y);
-		voxelProgram.setUniformMatrix4fv("mvp_z", mvp_z);
-
-		voxelProgram.setUniform1i("axis_override", settings.axisOverride);
-
-		voxelProgram.setUniform3fv("eye", camera.position);
-		voxelProgram.setUniform3fv("lightPos", mainlight.position);
-		voxelProgram.setUniform3fv("lightInt", mainlight.intensity);
+	// The clipmap follows the camera and only revoxelizes the slabs each level moved into. It keeps no static
+	// grid, so any geometry change rebuilds it whole. The dense grid is rebuilt whole when switching back.
+	std::vector<VoxelClipmap::Region> clipmapRegions;
+	if (settings.clipmap && !settings.sparseOctree) {
+		if (!clipmap.isInitialized()) {
+			clipmap.init(CLIPMAP_DIM, voxelSize, useRGBA16f ? GL_RGBA16F : GL_RGBA8);
+		}
+		clipmapRegions = clipmap.update(camera.position, clipmapDirty || dynamicVoxelsDirty);
+		clipmapDirty = false;
+		voxelsDirty = true;
+		voxelizeSkipped = clipmapRegions.empty();
+
+		clipmapVoxelsUpdated = 0;
+		for (const auto &region : clipmapRegions) {
+			glm::ivec3 size = region.max - region.min;
+			clipmapVoxelsUpdated += size.x * size.y * size.z;
+		}
+	}
 
-		GLenum voxelFormat = useRGBA16f ? GL_RGBA16F : GL_R32UI;
-		glBindImageTexture(0, voxelColor, 0, GL_TRUE, 0, GL_READ_WRITE, voxelFormat);
-		glBindImageTexture(1, voxelNormal, 0, GL_TRUE, 0, GL_READ_WRITE, voxelFormat);
+	// The octree keeps no static part either, it is rebuilt whole when geometry changes
+	bool rebuildOctree = false;
+	if (settings.sparseOctree) {
+		if (!octree.isInitialized()) {
+			octree.init(OCTREE_TILE_CAPACITY);
+		}
+		settings.octreeDepth = glm::clamp(settings.octreeDepth, SparseVoxelOctree::MIN_DEPTH, SparseVoxelOctree::MAX_DEPTH);
+		rebuildOctree = octreeDirty || dynamicVoxelsDirty || settings.octreeDepth != octree.getDepth();
+		voxelsDirty = true;
+		voxelizeSkipped = !rebuildOctree;
+	}
 
-		scene->draw(voxelProgram.getHandle());
+	voxelizeTimer.start();
+	if (rebuildOctree) {
+		GL_DEBUG_PUSH("Build Octree")
+		do {
+			octree.beginFragments();
+			voxelizeFragments(settings.octreeDepth);
+		} while (!octree.endFragments());
+		octree.build(settings.octreeDepth, voxelMin, std::max(voxelDims.x, std::max(voxelDims.y, voxelDims.z)) * voxelSize);
+		octreeDirty = false;
+		radianceDirty = true;
+		GL_DEBUG_POP()
+	}
+	if (!clipmapRegions.empty()) {
+		GL_DEBUG_PUSH("Voxelize Clipmap")
+		for (const auto &region : clipmapRegions) {
+			clipmap.clear(region);
+			voxelizeScene(Scene::Filter::All, clipmap.getColor(region.level), clipmap.getNormal(region.level), &region);
+		}
+		if (useRGBA16f) {
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			for (const auto &region : clipmapRegions) {
+				normalizeVoxels(clipmap.getColor(region.level), clipmap.getNormal(region.level), region.min, region.max - region.min);
+			}
+		}
+		GL_DEBUG_POP()
+	}
 
-		glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
-		glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
-		voxelProgram.unbind();
+	// Static nodes go into their own grid, only when they change
+	if (voxelsDirty && denseVoxels && !settings.sortedVoxelization) {
+		GL_DEBUG_PUSH("Voxelize Static")
+		glClearTexImage(staticVoxelColor, 0, GL_RGBA, GL_FLOAT, nullptr);
+		glClearTexImage(staticVoxelNormal, 0, GL_RGBA, GL_FLOAT, nullptr);
+		voxelizeScene(Scene::Filter::Static, staticVoxelColor, staticVoxelNormal);
+		glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+		GL_DEBUG_POP()
+	}
 
+	// The sorted list keeps no static part, any rebuild sorts and averages the whole scene again. Otherwise copy
+	// the static voxels over the region, unnormalized so dynamic fragments average in as if voxelized together,
+	// then add the dynamic nodes on top.
+	if (rebuildRegion && settings.sortedVoxelization) {
+		GL_DEBUG_PUSH("Voxelize Sorted")
+		voxelizeSorted();
+		GL_DEBUG_POP()
+	}
+	else if (rebuildRegion) {
+		GL_DEBUG_PUSH("Voxelize Dynamic")
+		glm::ivec3 regionSize = regionMax - regionMin;
+		for (GLuint texture : { voxelColor, voxelNormal }) {
+			GLuint source = texture == voxelColor ? staticVoxelColor : staticVoxelNormal;
+			glCopyImageSubData(
+				source, GL_TEXTURE_3D, 0, regionMin.x, regionMin.y, regionMin.z,
+				texture, GL_TEXTURE_3D, 0, regionMin.x, regionMin.y, regionMin.z,
+				regionSize.x, regionSize.y, regionSize.z
+			);
+		}
 
-		// Restore OpenGL state
-		glViewport(0, 0, width, height);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glDepthMask(GL_TRUE);
-		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-		if (GLAD_GL_NV_conservative_raster && settings.conservativeRasterization) {
-			glDisable(GL_CONSERVATIVE_RASTERIZATION_NV);
+		if (scene->hasDynamicNodes()) {
+			voxelizeScene(Scene::Filter::Dynamic, voxelColor, voxelNormal);
 		}
 		GL_DEBUG_POP()
 	}
+	if (rebuildRegion) {
+		// Occupancy only needs a nonzero alpha, so the lists exist before normalization uses them
+		buildOccupancy();
+		buildDistanceField();
+	}
 	voxelizeTimer.stop();
 
 	// Generate shadowmap
 	shadowmapTimer.start();
-	const float lz_near = 0.0f, lz_far = 100.0f, l_boundary = 25.0f;
-	glm::mat4 lp = glm::ortho(-l_boundary, l_boundary, -l_boundary, l_boundary, lz_near, lz_far);
 	glm::mat4 lv = glm::lookAt(mainlight.position, mainlight.position + mainlight.direction, glm::vec3(0.0f, 1.0f, 0.0f));
-	glm::mat4 ls = lp * lv;
+	if (settings.shadowmapSize != shadowmapSize) {
+		allocateShadowmaps(settings.shadowmapSize);
+	}
+	fitShadowCascades(lv);
 	{
 		GL_DEBUG_PUSH("Shadowmap")
-		shadowmapFBO.bind();
-		glViewport(0, 0, SHADOWMAP_WIDTH, SHADOWMAP_HEIGHT);
-		glClear(GL_DEPTH_BUFFER_BIT);
+		glViewport(0, 0, shadowmapSize, shadowmapSize);
 		glDisable(GL_BLEND);
 		glEnable(GL_CULL_FACE);
 		glCullFace(GL_FRONT);
 
-		glm::mat4 model;
+		glm::mat4 identity;
 
 		shadowmapProgram.bind();
-		shadowmapProgram.setUniformMatrix4fv("projection", lp);
-		shadowmapProgram.setUniformMatrix4fv("view", lv);
-		shadowmapProgram.setUniformMatrix4fv("model", model);
+		shadowmapProgram.setUniformMatrix4fv("view", identity);
+
+		// Static casters are cached per layer. Without dynamic casters the cache is the shadowmap itself,
+		// otherwise dynamic casters are drawn each frame over a copy of the cached depth.
+		bool composite = scene->hasDynamicNodes();
+		GLFramebuffer &staticFBO = composite ? staticShadowmapFBO : shadowmapFBO;
+		if (!settings.cacheShadows || scene->getStaticVersion() != cachedStaticVersion || composite != cachedComposite) {
+			std::fill(std::begin(shadowCacheValid), std::end(shadowCacheValid), false);
+			cachedStaticVersion = scene->getStaticVersion();
+			cachedComposite = composite;
+		}
 
-		scene->draw(shadowmapProgram.getHandle());
+		shadowLayersDrawn = 0;
+		for (int i = 0; i <= settings.shadowCascades; i++) {
+			int layer = i == settings.shadowCascades ? MAX_SHADOW_CASCADES : i;
+			shadowmapProgram.setUniformMatrix4fv("projection", shadowMatrices[layer]);
+
+			// Light and cascade changes both show up as a different matrix, each layer only draws the casters inside its own volume
+			if (!shadowCacheValid[layer] || cachedShadowMatrices[layer] != shadowMatrices[layer]) {
+				staticFBO.bind();
+				staticFBO.attachLayer(GL_DEPTH_ATTACHMENT, 0, layer);
+				glClear(GL_DEPTH_BUFFER_BIT);
+
+				scene->draw(shadowmapProgram.getHandle(), &shadowMatrices[layer], Scene::Filter::Static);
+
+				cachedShadowMatrices[layer] = shadowMatrices[layer];
+				shadowCacheValid[layer] = true;
+				shadowLayersDrawn++;
+			}
+
+			if (composite) {
+				glCopyImageSubData(
+					staticShadowmapFBO.getTexture(0), GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer,
+					shadowmapFBO.getTexture(0), GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer,
+					shadowmapSize, shadowmapSize, 1
+				);
+
+				shadowmapFBO.bind();
+				shadowmapFBO.attachLayer(GL_DEPTH_ATTACHMENT, 0, layer);
+				scene->draw(shadowmapProgram.getHandle(), &shadowMatrices[layer], Scene::Filter::Dynamic);
+			}
+		}
 
 		shadowmapProgram.unbind();
 		shadowmapFBO.unbind();
@@ -215,84 +521,181 @@ void Application::render(float dt) {
 	shadowmapTimer.stop();
 
 	// Normalize voxelColor and voxelNormal textures (divides by alpha component)
-	if (useRGBA16f) {
-		static GLShaderProgram *p = nullptr;
-		if (!p) {
-			p = new GLShaderProgram({SHADER_DIR "normalizeVoxels.comp"});
-			p->setObjectLabel("Normalize Voxels");
+	normalizeSkipped = !(rebuildRegion && (useRGBA16f || packedStorage()));
+	normalizeTimer.start();
+	if (rebuildRegion && useRGBA16f) {
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		if (settings.activeVoxelLists && !voxelListsOverflowed) {
+			normalizeVoxelList();
 		}
-		p->bind();
-		glBindImageTexture(0, voxelColor, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
-		glBindImageTexture(1, voxelNormal, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+		else {
+			normalizeVoxels(voxelColor, voxelNormal, regionMin, regionMax - regionMin);
+		}
+	}
+	// Everything after voxelization reads the packed normals, a static grid needs neither the full ones nor
+	// their static copy again
+	if (rebuildRegion && packedStorage()) {
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		packNormals(regionMin, regionMax - regionMin);
+		if (settings.dropVoxelNormal && !scene->hasDynamicNodes()) {
+			glDeleteTextures(1, &voxelNormal);
+			voxelNormal = 0;
+			glDeleteTextures(1, &staticVoxelNormal);
+			staticVoxelNormal = 0;
+		}
+	}
+	normalizeTimer.stop();
 
-		glDispatchCompute((voxelDim + 4 - 1) / 4, (voxelDim + 4 - 1) / 4, (voxelDim + 4 - 1) / 4);
+	if (rebuildRegion) {
+		voxelsDirty = false;
+		radianceDirty = true;
+	}
+	radianceSkipped = !radianceDirty;
 
-		glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
-		glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
-		p->unbind();
+	// Clipmap radiance is injected per voxel into the updated regions, or every level when the light changed
+	std::vector<VoxelClipmap::Region> injectRegions;
+	if (settings.clipmap && !settings.sparseOctree) {
+		injectRegions = radianceDirty ? clipmap.getLevels() : clipmapRegions;
+		radianceSkipped = injectRegions.empty();
+	}
+	if (!denseVoxels) {
+		mipmapSkipped = true;
 	}
 
 	// Inject radiance into voxel grid
 	radianceTimer.start();
-	{
+	if (settings.sparseOctree) {
+		if (radianceDirty) {
+			GL_DEBUG_PUSH("Octree Radiance Injection")
+			octree.inject(shadowmapFBO.getTexture(0), shadowMatrices, MAX_SHADOW_CASCADES + 1, settings.shadowCascades, mainlight.position, mainlight.intensity);
+			GL_DEBUG_POP()
+		}
+		radianceDirty = false;
+	}
+	else if (settings.clipmap) {
+		if (!injectRegions.empty()) {
+			GL_DEBUG_PUSH("Clipmap Radiance Injection")
+			injectClipmap(injectRegions);
+			GL_DEBUG_POP()
+		}
+		radianceDirty = false;
+	}
+	else if (radianceDirty && settings.voxelInjection && !voxelListsOverflowed) {
+		GL_DEBUG_PUSH("Voxel Radiance Injection")
+		injectVoxels();
+		radianceDirty = false;
+		mipsDirty = true;
+		GL_DEBUG_POP()
+	}
+	else if (radianceDirty) {
 		GL_DEBUG_PUSH("Radiance Injection")
 
-		glClearTexImage(voxelRadiance, 0, GL_RGBA, GL_FLOAT, nullptr);
+		clearRadianceLevel(0);
+		// Shadowmap texels may land in voxels outside the brick list
+		radianceBricksValid = false;
 
 		injectRadianceProgram.bind();
 
-		glBindImageTexture(0, voxelColor, 0, GL_TRUE, 0, GL_READ_ONLY, useRGBA16f ? GL_RGBA16F : GL_RGBA8);
-		glBindImageTexture(1, voxelNormal, 0, GL_TRUE, 0, GL_READ_ONLY, useRGBA16f ? GL_RGBA16F : GL_RGBA8);
-		glBindImageTexture(2, voxelRadiance, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+		GLenum voxelFormat = useRGBA16f ? GL_RGBA16F : GL_RGBA8;
+		glBindImageTexture(0, voxelColor, 0, GL_TRUE, 0, GL_READ_ONLY, voxelFormat);
+		glBindImageTexture(1, packedStorage() ? packedVoxelNormal : voxelNormal, 0, GL_TRUE, 0, GL_READ_ONLY, packedStorage() ? GL_RG8 : voxelFormat);
+		bindRadianceImage(2, 3, 0, GL_WRITE_ONLY);
 
+		// Injection covers the whole volume, so it reads the voxel volume layer rather than the cascades
 		GLuint shadowmap = shadowmapFBO.getTexture(0);
 		glBindTextureUnit(1, shadowmap);
 		injectRadianceProgram.setUniform1i("shadowmap", 1);
+		injectRadianceProgram.setUniform1i("shadowLayer", MAX_SHADOW_CASCADES);
 
-		glm::mat4 lsInverse = glm::inverse(ls);
+		glm::mat4 lsInverse = glm::inverse(shadowMatrices[MAX_SHADOW_CASCADES]);
 		injectRadianceProgram.setUniformMatrix4fv("lsInverse", lsInverse);
 		injectRadianceProgram.setUniform3fv("lightPos", mainlight.position);
 		injectRadianceProgram.setUniform3fv("lightInt", mainlight.intensity);
 
-		injectRadianceProgram.setUniform1i("voxelDim", voxelDim);
+		injectRadianceProgram.setUniformMatrix4fv("worldToVoxel", worldToVoxel());
 
 		// 2D workgroup should be the size of shadowmap, local_size = 16
-		glDispatchCompute((SHADOWMAP_WIDTH + 16 - 1) / 16, (SHADOWMAP_HEIGHT + 16 - 1) / 16, 1);
+		glDispatchCompute((shadowmapSize + 16 - 1) / 16, (shadowmapSize + 16 - 1) / 16, 1);
 
 		glBindTextureUnit(1, 0);
 		glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA16F);
 		glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA16F);
-		glBindImageTexture(2, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+		bindRadianceImage(2, 3, -1, GL_WRITE_ONLY);
 		injectRadianceProgram.unbind();
 
+		radianceDirty = false;
+		mipsDirty = true;
 		GL_DEBUG_POP()
 	}
 	radianceTimer.stop();
 
+	if (denseVoxels) {
+		mipmapSkipped = !mipsDirty;
+	}
 	mipmapTimer.start();
-	{
+	if (mipsDirty && denseVoxels) {
 		// glGenerateTextureMipmap(voxelColor);
 		// glGenerateTextureMipmap(voxelNormal);
 		// glGenerateTextureMipmap(voxelRadiance);
 
-		mipmapProgram.bind();
-
-		int dim = voxelDim;
-		const int local_size = 8;
-		for (int level = 0; level < voxelLevels; level++) {
-			glBindImageTexture(0, voxelRadiance, level, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8);
-			glBindImageTexture(1, voxelRadiance, level + 1, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
-
-			GLuint num_groups = ((dim >> 1) + local_size - 1) / local_size;
-			glDispatchCompute(num_groups, num_groups, num_groups);
-
-			glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8);
-			glBindImageTexture(1, 0, 1, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
-
-			dim >>= 1;
+		if (settings.activeVoxelLists && !voxelListsOverflowed) {
+			// Levels 1 and 2 only where there are occupied bricks, the small levels above as usual
+			filterBricksProgram.bind();
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			// Unlisted bricks were zeroed before injection when the recorded bricks are valid
+			if (!radianceBricksValid) {
+				clearRadianceLevel(1);
+				clearRadianceLevel(2);
+			}
+
+			bindRadianceImage(0, 3, 0, GL_READ_ONLY);
+			bindRadianceImage(1, 4, 1, GL_WRITE_ONLY);
+			bindRadianceImage(2, 5, 2, GL_WRITE_ONLY);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, brickListBuffer);
+			glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, brickListBuffer);
+			glDispatchComputeIndirect(0);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+			glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, 0);
+			for (int unit = 0; unit < 3; unit++) {
+				bindRadianceImage(unit, unit + 3, -1, GL_READ_ONLY);
+			}
+			filterBricksProgram.unbind();
+
+			filterRadianceLevels(2);
 		}
-
-		mipmapProgram.unbind();
+		// The opacity levels would need more image units than the single pass has
+		else if (settings.singlePassMips && !packedStorage()) {
+			mipmapSinglePassProgram.bind();
+			mipmapSinglePassProgram.setUniform1i("levels", voxelLevels - 1);
+			mipmapSinglePassProgram.setUniform1i("useOccupancy", settings.occupancySkipping);
+			mipmapSinglePassProgram.setUniform1i("occupancyVoxels", 0);
+			glBindTextureUnit(0, occupancyVoxels);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+			glBindImageTexture(0, voxelRadiance, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8);
+			for (int level = 1; level < voxelLevels; level++) {
+				glBindImageTexture(level, voxelRadiance, level, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA8);
+			}
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, mipCounterBuffer);
+
+			// A workgroup per 16^3 tile of level 0
+			glm::ivec3 num_groups = (voxelDims + 15) / 16;
+			glDispatchCompute(num_groups.x, num_groups.y, num_groups.z);
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+			glBindTextureUnit(0, 0);
+			for (int level = 0; level < voxelLevels; level++) {
+				glBindImageTexture(level, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8);
+			}
+			mipmapSinglePassProgram.unbind();
+		}
+		else {
+			filterRadianceLevels(0);
+		}
+		mipsDirty = false;
 	}
 	mipmapTimer.stop();
 
@@ -300,6 +703,12 @@ void Application::render(float dt) {
 	// Render scene
 	{
 		GL_DEBUG_PUSH("Render Scene")
+		// Cone sample counters, unless the next buffer has not been read back yet
+		coneStatsRecording = coneStats && !coneSampleFences[coneSampleIndex];
+		if (coneStatsRecording) {
+			glClearNamedBufferData(coneSampleBuffers[coneSampleIndex], GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, coneSampleBuffers[coneSampleIndex]);
+		}
 		glm::mat4 projection = glm::perspective(camera.fov, (float)width / height, near, far);
 		glm::mat4 view = camera.lookAt();
 		glm::mat4 model;
@@ -310,58 +719,158 @@ void Application::render(float dt) {
 		glEnable(GL_CULL_FACE);
 		glPolygonMode(GL_FRONT_AND_BACK, settings.drawWireframe ? GL_LINE : GL_FILL);
 
-		program.bind();
-		program.setUniformMatrix4fv("projection", projection);
-		program.setUniformMatrix4fv("view", view);
-		program.setUniformMatrix4fv("model", model);
-		program.setUniform3fv("eye", camera.position);
-		program.setUniform3fv("lightPos", mainlight.position);
-		program.setUniform3fv("lightInt", mainlight.intensity);
-		program.setUniformMatrix4fv("ls", ls);
-		program.setUniform1i("texture0", 0);
-
-		GLuint shadowmap = shadowmapFBO.getTexture(0);
-		glBindTextureUnit(1, shadowmap);
-		program.setUniform1i("shadowmap", 1);
-
-		program.setUniform1i("voxelize", settings.drawVoxels);
-		program.setUniform1i("normals", settings.drawNormals);
-		program.setUniform1i("dominant_axis", settings.drawDominantAxis);
-		program.setUniform1i("radiance", settings.drawRadiance);
-
-		program.setUniform1i("enableShadows", settings.enableShadows);
-		program.setUniform1i("enableNormalMap", settings.enableNormalMap);
-		program.setUniform1i("enableIndirect", settings.enableIndirect);
-		program.setUniform1i("enableDiffuse", settings.enableDiffuse);
-		program.setUniform1i("enableSpecular", settings.enableSpecular);
-		program.setUniform1f("ambientScale", settings.ambientScale);
-
-		program.setUniform1i("voxelDim", voxelDim);
-
-		glBindTextureUnit(2, voxelColor);
-		program.setUniform1i("voxelColor", 2);
-		program.setUniform1i("miplevel", settings.miplevel);
-		program.setUniform1i("voxelDim", voxelDim);
-
-		glBindTextureUnit(3, voxelNormal);
-		program.setUniform1i("voxelNormal", 3);
-
-		glBindTextureUnit(4, voxelRadiance);
-		program.setUniform1i("voxelRadiance", 4);
-
-		program.setUniform1i("vctSteps", settings.vctSteps);
-		program.setUniform1f("vctBias", settings.vctBias);
-		program.setUniform1f("vctConeAngle", settings.vctConeAngle);
-		program.setUniform1f("vctConeInitialHeight", settings.vctConeInitialHeight);
-		program.setUniform1f("vctLodOffset", settings.vctLodOffset);
-
-		scene->draw(program.getHandle());
-
-		glBindTextureUnit(1, 0);
-		glBindTextureUnit(2, 0);
-		glBindTextureUnit(3, 0);
-		glBindTextureUnit(4, 0);
-		program.unbind();
+		if (settings.deferred) {
+			// Geometry pass
+			gbufferFBO.bind();
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			gbufferProgram.bind();
+			gbufferProgram.setUniformMatrix4fv("projection", projection);
+			gbufferProgram.setUniformMatrix4fv("view", view);
+			gbufferProgram.setUniformMatrix4fv("model", model);
+			gbufferProgram.setUniform1i("enableNormalMap", settings.enableNormalMap);
+
+			scene->draw(gbufferProgram.getHandle());
+
+			gbufferProgram.unbind();
+			gbufferFBO.unbind();
+
+			const char *gbufferSamplers[] = { "gAlbedo", "gNormal", "gTangent", "gShading", "gDepth" };
+			for (int i = 0; i < 5; i++) {
+				glBindTextureUnit(6 + i, gbufferFBO.getTexture(i));
+			}
+			glm::mat4 invViewProjection = glm::inverse(projection * view);
+
+			int indirectScale = settings.reducedIndirect ? settings.indirectScale : 1;
+			bool checkerboard = settings.reducedIndirect && settings.checkerboardIndirect;
+			auto setGBufferInputs = [&](GLShaderProgram &p) {
+				for (int i = 0; i < 5; i++) {
+					p.setUniform1i(gbufferSamplers[i], 6 + i);
+				}
+				p.setUniformMatrix4fv("invViewProjection", invViewProjection);
+				p.setUniform1f("near", near);
+				p.setUniform1f("far", far);
+				p.setUniform1i("indirectScale", indirectScale);
+				p.setUniform1i("checkerboard", checkerboard);
+			};
+
+			// Indirect pass, cones are traced once per texel of the indirect buffer
+			indirectTimer.start();
+			if (settings.enableIndirect) {
+				glm::ivec2 indirectSize = checkerboard
+					? glm::ivec2((width + 1) / 2, height)
+					: glm::ivec2((width + indirectScale - 1) / indirectScale, (height + indirectScale - 1) / indirectScale);
+
+				indirectLightingProgram.bind();
+				bindShadingInputs(indirectLightingProgram, mainlight);
+				setGBufferInputs(indirectLightingProgram);
+				indirectLightingProgram.setUniform1i("temporal", settings.temporalIndirect);
+				indirectLightingProgram.setUniform1i("temporalCones", settings.temporalCones);
+				indirectLightingProgram.setUniform1i("frame", frame);
+				glBindImageTexture(0, indirectFBO.getTexture(0), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+				glDispatchCompute((indirectSize.x + 8 - 1) / 8, (indirectSize.y + 8 - 1) / 8, 1);
+				glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+				glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+				unbindShadingInputs();
+				indirectLightingProgram.unbind();
+			}
+
+			// Temporal pass, reprojects the accumulated indirect light and blends in this frame's samples.
+			// The result is full resolution so the lighting pass reads it without upsampling.
+			GLuint indirectTexture = indirectFBO.getTexture(0);
+			bool temporal = settings.enableIndirect && settings.temporalIndirect;
+			if (temporal) {
+				glBindTextureUnit(11, indirectFBO.getTexture(0));
+				glBindTextureUnit(12, historyFBO.getTexture(historyIndex));
+				glBindImageTexture(0, historyFBO.getTexture(1 - historyIndex), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+				temporalIndirectProgram.bind();
+				setGBufferInputs(temporalIndirectProgram);
+				temporalIndirectProgram.setUniform1i("indirectBuffer", 11);
+				temporalIndirectProgram.setUniform1i("history", 12);
+				temporalIndirectProgram.setUniformMatrix4fv("prevViewProjection", prevViewProjection);
+				temporalIndirectProgram.setUniform1i("historyValid", historyValid);
+				temporalIndirectProgram.setUniform1f("temporalBlend", settings.temporalBlend);
+
+				glDispatchCompute((width + 8 - 1) / 8, (height + 8 - 1) / 8, 1);
+				glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+				temporalIndirectProgram.unbind();
+				glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+				glBindTextureUnit(12, 0);
+
+				historyIndex = 1 - historyIndex;
+				indirectTexture = historyFBO.getTexture(historyIndex);
+			}
+			historyValid = temporal;
+			prevViewProjection = projection * view;
+			indirectTimer.stop();
+
+			// Lighting pass, indirect light is upsampled with depth and normal weights when reduced
+			deferredShadingProgram.bind();
+			bindShadingInputs(deferredShadingProgram, mainlight);
+			setGBufferInputs(deferredShadingProgram);
+			deferredShadingProgram.setUniform3fv("background", CLEAR_COLOR);
+			if (temporal) {
+				deferredShadingProgram.setUniform1i("indirectScale", 1);
+				deferredShadingProgram.setUniform1i("checkerboard", false);
+			}
+
+			glBindTextureUnit(11, indirectTexture);
+			deferredShadingProgram.setUniform1i("indirectBuffer", 11);
+			glBindImageTexture(0, deferredFBO.getTexture(0), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+			glDispatchCompute((width + 8 - 1) / 8, (height + 8 - 1) / 8, 1);
+			glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+			glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+			for (int i = 0; i < 6; i++) {
+				glBindTextureUnit(6 + i, 0);
+			}
+			unbindShadingInputs();
+			deferredShadingProgram.unbind();
+
+			glBlitNamedFramebuffer(deferredFBO.getHandle(), 0, 0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		}
+		else {
+			// Depth only pass so the forward pass shades each pixel once
+			if (settings.depthPrepass) {
+				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+				shadowmapProgram.bind();
+				shadowmapProgram.setUniformMatrix4fv("projection", projection);
+				shadowmapProgram.setUniformMatrix4fv("view", view);
+				shadowmapProgram.setUniformMatrix4fv("model", model);
+
+				scene->draw(shadowmapProgram.getHandle());
+
+				shadowmapProgram.unbind();
+
+				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				glDepthFunc(GL_LEQUAL);
+				glDepthMask(GL_FALSE);
+			}
+
+			program.bind();
+			program.setUniformMatrix4fv("projection", projection);
+			program.setUniformMatrix4fv("view", view);
+			program.setUniformMatrix4fv("model", model);
+			program.setUniform1i("texture0", 0);
+			program.setUniform1i("enableNormalMap", settings.enableNormalMap);
+			bindShadingInputs(program, mainlight);
+
+			scene->draw(program.getHandle());
+
+			unbindShadingInputs();
+			program.unbind();
+
+			if (settings.depthPrepass) {
+				glDepthFunc(GL_LESS);
+				glDepthMask(GL_TRUE);
+			}
+		}
 
 		// glDisable(GL_FRAMEBUFFER_SRGB);
 		if (settings.drawWireframe) {
@@ -371,17 +880,60 @@ void Application::render(float dt) {
 	}
 	renderTimer.stop();
 	totalTimer.stop();
+	frame++;
+
+	if (coneStatsRecording) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+		glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+		coneSampleFences[coneSampleIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		coneSampleIndex = (coneSampleIndex + 1) % CONE_SAMPLE_BUFFERS;
+	}
+	// Oldest first, so the newest finished frame is shown
+	for (int i = 0; i < CONE_SAMPLE_BUFFERS; i++) {
+		int index = (coneSampleIndex + i) % CONE_SAMPLE_BUFFERS;
+		GLsync &fence = coneSampleFences[index];
+		if (!fence || glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			continue;
+		glDeleteSync(fence);
+		fence = 0;
+		const GLuint *coneSamples = coneSampleCounts[index];
+		samplesPerTracedPixel = coneSamples[1] > 0 ? (float)coneSamples[0] / coneSamples[1] : 0.0f;
+		samplesPerPixel = (float)coneSamples[0] / (width * height);
+		samplesSavedPerPixel = (float)coneSamples[2] / (width * height);
+	}
+	if (voxelListStatsFrame >= 0 && frame > voxelListStatsFrame + 1) {
+		GLuint counts[2];
+		glGetNamedBufferSubData(voxelListStats, 0, sizeof(counts), counts);
+		listedVoxels = counts[0];
+		listedBricks = counts[1];
+		voxelListStatsFrame = -1;
+
+		// The counts keep growing past the capacity, what did not fit got no radiance. Grow the voxel list and
+		// rebuild, or run the full grid passes once a list is longer than one dispatch covers.
+		if (listedVoxels > voxelListCapacity || listedBricks > brickListCapacity) {
+			if (listedVoxels <= MAX_LISTED_VOXELS && listedBricks <= brickListCapacity) {
+				resizeVoxelList(std::min(listedVoxels + listedVoxels / 4, MAX_LISTED_VOXELS));
+			}
+			else {
+				voxelListsOverflowed = true;
+				LOG_WARN("Voxel lists overflowed with ", listedVoxels, " voxels and ", listedBricks, " bricks, using full grid passes");
+			}
+			voxelsDirty = true;
+		}
+	}
 
 	voxelizeTimer.getQueryResult();
+	normalizeTimer.getQueryResult();
 	shadowmapTimer.getQueryResult();
 	radianceTimer.getQueryResult();
 	mipmapTimer.getQueryResult();
 	renderTimer.getQueryResult();
+	indirectTimer.getQueryResult();
 	totalTimer.getQueryResult();
 
 	// hacky view of shadowmap
 	if (settings.drawShadowmap) {
-		view2DTexture(shadowmapFBO.getTexture(0));
+		view2DTexture(shadowmapLayerViews[glm::clamp(settings.shadowmapLayer, 0, MAX_SHADOW_CASCADES)]);
 	}
 
 	// hacky raymarcher
@@ -397,8 +949,107 @@ void Application::render(float dt) {
 	}
 }
 
+// Sets lighting and cone tracing uniforms declared in vct.glsl and binds the shadowmap and voxel textures
+void Application::bindShadingInputs(GLShaderProgram &p, const Light &light) {
+	p.setUniform3fv("eye", camera.position);
+	p.setUniform3fv("lightPos", light.position);
+	p.setUniform3fv("lightInt", light.intensity);
+	p.setUniformMatrix4fv("shadowMatrices", shadowMatrices, MAX_SHADOW_CASCADES + 1);
+	p.setUniform1i("shadowCascades", settings.shadowCascades);
+
+	GLuint shadowmap = shadowmapFBO.getTexture(0);
+	glBindTextureUnit(1, shadowmap);
+	p.setUniform1i("shadowmap", 1);
+
+	p.setUniform1i("voxelize", settings.drawVoxels);
+	p.setUniform1i("normals", settings.drawNormals);
+	p.setUniform1i("dominant_axis", settings.drawDominantAxis);
+	p.setUniform1i("radiance", settings.drawRadiance);
+
+	p.setUniform1i("enableShadows", settings.enableShadows);
+	p.setUniform1i("enableIndirect", settings.enableIndirect);
+	p.setUniform1i("enableDiffuse", settings.enableDiffuse);
+	p.setUniform1i("enableSpecular", settings.enableSpecular);
+	p.setUniform1f("ambientScale", settings.ambientScale);
+
+	glBindTextureUnit(2, voxelColor);
+	p.setUniform1i("voxelColor", 2);
+	p.setUniform1i("miplevel", settings.miplevel);
+	p.setUniformMatrix4fv("worldToVoxel", worldToVoxel());
+	p.setUniform1f("voxelSize", voxelSize);
+
+	glBindTextureUnit(3, packedStorage() ? packedVoxelNormal : voxelNormal);
+	p.setUniform1i("voxelNormal", 3);
+
+	glBindTextureUnit(4, voxelRadiance);
+	p.setUniform1i("voxelRadiance", 4);
+	// Packed storage only, 0 otherwise
+	glBindTextureUnit(20, voxelOpacity);
+	p.setUniform1i("voxelOpacity", 20);
+
+	p.setUniform1i("vctSteps", settings.vctSteps);
+	p.setUniform1i("coneStats", coneStatsRecording);
+	p.setUniform1f("vctBias", settings.vctBias);
+	p.setUniform1f("vctConeAngle", settings.vctConeAngle);
+	p.setUniform1f("vctConeInitialHeight", settings.vctConeInitialHeight);
+	p.setUniform1f("vctLodOffset", settings.vctLodOffset);
+
+	p.setUniform1i("adaptiveCones", settings.adaptiveCones);
+	p.setUniform1f("coneBudget", settings.coneBudget);
+	p.setUniform1f("pixelAngle", 2.0f * std::tan(camera.fov / 2.0f) / height);
+
+	// Units 13 to 16, set even when unused so the 3D samplers never share a unit with a 2D one
+	GLint clipUnits[VoxelClipmap::LEVELS];
+	for (int level = 0; level < VoxelClipmap::LEVELS; level++) {
+		clipUnits[level] = 13 + level;
+	}
+	p.setUniform1iv("clipRadiance", clipUnits, VoxelClipmap::LEVELS);
+	bool traceClipmap = settings.clipmap && !settings.sparseOctree && clipmap.isInitialized();
+	p.setUniform1i("clipmap", traceClipmap);
+	if (traceClipmap) {
+		glm::ivec3 clipOrigins[VoxelClipmap::LEVELS];
+		for (int level = 0; level < VoxelClipmap::LEVELS; level++) {
+			glBindTextureUnit(clipUnits[level], clipmap.getRadiance(level));
+			clipOrigins[level] = clipmap.getOrigin(level);
+		}
+		p.setUniform3iv("clipOrigins", clipOrigins, VoxelClipmap::LEVELS);
+		p.setUniform1f("clipVoxelSize", clipmap.getVoxelSize(0));
+		p.setUniform1i("clipDim", clipmap.getDim());
+	}
+
+	// Occupancy only describes the dense grid
+	glBindTextureUnit(18, occupancyBricks);
+	p.setUniform1i("occupancyBricks", 18);
+	bool denseTracing = !traceClipmap && !(settings.sparseOctree && octree.isInitialized());
+	p.setUniform1i("useOccupancy", settings.occupancySkipping && denseTracing);
+	glBindTextureUnit(19, distanceField);
+	p.setUniform1i("distanceField", 19);
+	p.setUniform1i("useDistanceField", settings.distanceField && denseTracing);
+
+	p.setUniform1i("svoBricks", 17);
+	p.setUniform1i("svo", settings.sparseOctree && octree.isInitialized());
+	if (settings.sparseOctree && octree.isInitialized()) {
+		octree.bindTracing(p, 17);
+	}
+}
+
+void Application::unbindShadingInputs() {
+	glBindTextureUnit(1, 0);
+	glBindTextureUnit(2, 0);
+	glBindTextureUnit(3, 0);
+	glBindTextureUnit(4, 0);
+	for (int level = 0; level < VoxelClipmap::LEVELS; level++) {
+		glBindTextureUnit(13 + level, 0);
+	}
+	glBindTextureUnit(17, 0);
+	glBindTextureUnit(18, 0);
+	glBindTextureUnit(19, 0);
+	glBindTextureUnit(20, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+}
+
 // Create a 3D texture
-GLuint make3DTexture(GLsizei size, GLsizei levels, GLenum internalFormat, GLint minFilter, GLint magFilter) {
+GLuint make3DTexture(const glm::ivec3 &size, GLsizei levels, GLenum internalFormat, GLint minFilter, GLint magFilter) {
 	GLuint handle;
 
 	glGenTextures(1, &handle);
@@ -410,7 +1061,7 @@ GLuint make3DTexture(GLsizei size, GLsizei levels, GLenum internalFormat, GLint
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-	glTexStorage3D(GL_TEXTURE_3D, levels, internalFormat, size, size, size);
+	glTexStorage3D(GL_TEXTURE_3D, levels, internalFormat, size.x, size.y, size.z);
 	glClearTexImage(handle, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
 
 	if (levels > 1) {
@@ -422,6 +1073,862 @@ GLuint make3DTexture(GLsizei size, GLsizei levels, GLenum internalFormat, GLint
 	return handle;
 }
 
+// Voxelizes the filtered scene nodes into color and normal, adding to what they already hold. Covers the dense
+// volume, or with a clipmap region a cube of that level's voxels starting at the region, clipped to the region.
+void Application::voxelizeScene(Scene::Filter filter, GLuint color, GLuint normal, const VoxelClipmap::Region *region) {
+	// The compute voxelizer only covers the dense grid
+	if (!region && settings.computeVoxelization) {
+		voxelizeCompute(filter, color, normal, false);
+		return;
+	}
+
+	glm::vec3 boxMin = voxelMin;
+	float size = voxelSize;
+	int resolution = std::max(voxelDims.x, std::max(voxelDims.y, voxelDims.z));
+	glm::mat4 cull;
+	if (region) {
+		size = clipmap.getVoxelSize(region->level);
+		glm::ivec3 regionSize = region->max - region->min;
+		resolution = std::max(regionSize.x, std::max(regionSize.y, regionSize.z));
+		boxMin = glm::vec3(region->min) * size;
+
+		glm::vec3 boxMax = glm::vec3(region->max) * size;
+		cull = glm::ortho(boxMin.x, boxMax.x, boxMin.y, boxMax.y, -boxMax.z, -boxMin.z);
+	}
+
+	setVoxelUniforms([&](GLShaderProgram &p) {
+		p.setUniform1i("clipmap", region != nullptr);
+		p.setUniformMatrix4fv("worldToVoxel", worldToVoxel());
+		if (region) {
+			p.setUniform1f("clipVoxelSize", size);
+			p.setUniform3i("regionMin", region->min.x, region->min.y, region->min.z);
+			p.setUniform3i("regionMax", region->max.x, region->max.y, region->max.z);
+		}
+	});
+
+	GLenum voxelFormat = useRGBA16f ? GL_RGBA16F : GL_R32UI;
+	glBindImageTexture(0, color, 0, GL_TRUE, 0, GL_READ_WRITE, voxelFormat);
+	glBindImageTexture(1, normal, 0, GL_TRUE, 0, GL_READ_WRITE, voxelFormat);
+
+	rasterizeVoxels(filter, boxMin, size, resolution, region ? &cull : nullptr);
+
+	glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	setVoxelUniforms([](GLShaderProgram &p) { p.setUniform1i("clipmap", false); });
+}
+
+// Appends the whole scene to the octree's fragment list at 2^depth voxels across the voxel volume
+void Application::voxelizeFragments(int depth) {
+	int resolution = 1 << depth;
+	// The cube around the dense grid
+	float size = std::max(voxelDims.x, std::max(voxelDims.y, voxelDims.z)) * voxelSize;
+
+	setVoxelUniforms([&](GLShaderProgram &p) {
+		p.setUniform1i("fragmentList", true);
+		p.setUniform1i("svoDepth", depth);
+		p.setUniform3fv("svoMin", voxelMin);
+		p.setUniform1f("svoSize", size);
+	});
+
+	rasterizeVoxels(Scene::Filter::All, voxelMin, size / resolution, resolution, nullptr);
+
+	setVoxelUniforms([](GLShaderProgram &p) { p.setUniform1i("fragmentList", false); });
+}
+
+// Rebuilds the whole dense grid from the sorted fragment list. Averages can not be added to, so unlike the
+// atomic paths there is no static grid to start from.
+void Application::voxelizeSorted() {
+	if (!fragmentSort.isInitialized()) {
+		fragmentSort.init(1 << 20);
+	}
+	glClearTexImage(voxelColor, 0, GL_RGBA, GL_FLOAT, nullptr);
+	glClearTexImage(voxelNormal, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+	setVoxelUniforms([](GLShaderProgram &p) { p.setUniform1i("sortedFragments", true); });
+	do {
+		fragmentSort.beginFragments();
+		if (settings.computeVoxelization) {
+			voxelizeCompute(Scene::Filter::All, voxelColor, voxelNormal, true);
+		}
+		else {
+			voxelizeScene(Scene::Filter::All, voxelColor, voxelNormal);
+		}
+	} while (!fragmentSort.endFragments());
+	setVoxelUniforms([](GLShaderProgram &p) { p.setUniform1i("sortedFragments", false); });
+
+	// Enough bits of the Morton key to cover the longest axis
+	int axisBits = 0;
+	while ((1 << axisBits) < std::max(voxelDims.x, std::max(voxelDims.y, voxelDims.z))) {
+		axisBits++;
+	}
+	fragmentSort.sort(3 * axisBits);
+	fragmentSort.reduce(voxelColor, voxelNormal, useRGBA16f ? GL_RGBA16F : GL_RGBA8);
+}
+
+// Adds the filtered nodes to the dense grid's color and normal with the compute voxelizer, or to the sorted
+// fragment list
+void Application::voxelizeCompute(Scene::Filter filter, GLuint color, GLuint normal, bool sortedFragments) {
+	if (!computeVoxelizer.isInitialized()) {
+		computeVoxelizer.init();
+	}
+	computeVoxelizer.voxelize(*scene, filter, color, normal, useRGBA16f ? GL_RGBA16F : GL_R32UI, voxelMin, voxelSize, sortedFragments);
+}
+
+// Voxelizes the whole scene with CPUVoxelizer and logs how the dense grid compares voxel for voxel. Coverage
+// should match the compute voxelizer exactly, rasterization covers voxels differently.
+void Application::compareCPUVoxelization() {
+	if (settings.clipmap || settings.sparseOctree) {
+		LOG_WARN("CPU voxelization only compares against the dense grid");
+		return;
+	}
+
+	std::vector<CPUTriangles> triangles;
+	std::map<std::string, CPUImage> images;
+	scene->getTriangles(triangles, images);
+
+	CPUVoxelizer voxelizer;
+	CPUVoxelGrid grid;
+	auto start = std::chrono::high_resolution_clock::now();
+	voxelizer.voxelize(triangles, voxelDims, voxelMin, voxelSize, grid);
+	std::chrono::duration<double> cpuTime = std::chrono::high_resolution_clock::now() - start;
+
+	std::vector<glm::vec4> gpu(grid.color.size());
+	glGetTextureImage(voxelColor, 0, GL_RGBA, GL_FLOAT, (GLsizei)(gpu.size() * sizeof(glm::vec4)), gpu.data());
+
+	size_t both = 0, cpuOnly = 0, gpuOnly = 0;
+	double colorError = 0.0;
+	for (size_t i = 0; i < gpu.size(); i++) {
+		bool cpuVoxel = grid.color[i].w > 0.0f, gpuVoxel = gpu[i].w > 0.0f;
+		if (cpuVoxel && gpuVoxel) {
+			both++;
+			colorError += glm::length(glm::vec3(grid.color[i]) - glm::vec3(gpu[i]));
+		}
+		else if (cpuVoxel) {
+			cpuOnly++;
+		}
+		else if (gpuVoxel) {
+			gpuOnly++;
+		}
+	}
+	LOG_INFO(
+		"\n\tCPU voxelization  ", cpuTime.count() * 1000.0, " ms, ", voxelizer.getThreadCount(), " threads", CPUVoxelizer::usesAVX2() ? ", AVX2" : "",
+		"\n\tvoxels in both    ", both,
+		"\n\tCPU only          ", cpuOnly,
+		"\n\tGPU only          ", gpuOnly,
+		"\n\tmean color error  ", both > 0 ? colorError / both : 0.0
+	);
+}
+
+// Rebuilds the radiance mips from level 0 with CPUMipBuilder and logs the texels the GPU levels differ in. Filtering
+// level by level should match exactly, the single pass keeps its inner levels in float and active voxel lists only
+// filter occupied bricks, so those differ slightly.
+void Application::compareCPUMips() {
+	if (settings.clipmap || settings.sparseOctree || packedStorage()) {
+		LOG_WARN("CPU mips only compare against RGBA8 dense radiance");
+		return;
+	}
+
+	CPUMipPyramid pyramid;
+	pyramid.dims = voxelDims;
+	pyramid.format = CPUMipPyramid::RGBA8;
+	pyramid.levels.resize(1);
+	pyramid.levels[0].resize((size_t)voxelDims.x * voxelDims.y * voxelDims.z * pyramid.texelSize());
+	glGetTextureImage(voxelRadiance, 0, GL_RGBA, GL_UNSIGNED_BYTE, (GLsizei)pyramid.levels[0].size(), pyramid.levels[0].data());
+
+	CPUMipBuilder builder;
+	auto start = std::chrono::high_resolution_clock::now();
+	builder.build(pyramid, voxelLevels);
+	std::chrono::duration<double> cpuTime = std::chrono::high_resolution_clock::now() - start;
+	LOG_INFO("CPU mips ", cpuTime.count() * 1000.0, " ms, ", builder.getThreadCount(), " threads");
+
+	for (int level = 1; level < (int)pyramid.levels.size(); level++) {
+		const std::vector<unsigned char> &cpu = pyramid.levels[level];
+		std::vector<unsigned char> gpu(cpu.size());
+		glGetTextureImage(voxelRadiance, level, GL_RGBA, GL_UNSIGNED_BYTE, (GLsizei)gpu.size(), gpu.data());
+
+		size_t differing = 0;
+		int maxDifference = 0;
+		for (size_t i = 0; i < cpu.size(); i += 4) {
+			int difference = 0;
+			for (size_t c = i; c < i + 4; c++) {
+				difference = std::max(difference, std::abs((int)cpu[c] - (int)gpu[c]));
+			}
+			differing += difference > 0;
+			maxDifference = std::max(maxDifference, difference);
+		}
+		LOG_INFO("\tlevel ", level, ": ", differing, " of ", cpu.size() / 4, " texels differ, by at most ", maxDifference);
+	}
+}
+
+// Sets uniforms on both voxelization programs, they stay with each program across binds
+void Application::setVoxelUniforms(const std::function<void(GLShaderProgram &p)> &set) {
+	for (GLShaderProgram *p : { &voxelProgram, &voxelAxisProgram }) {
+		p->bind();
+		set(*p);
+	}
+	voxelAxisProgram.unbind();
+}
+
+// Draws the filtered nodes with the voxelization programs, their outputs bound by the caller, each triangle
+// projected along its dominant axis onto one pixel per voxel of the cube from boxMin with resolution voxels per
+// side. Static nodes come pre-binned by axis, see Mesh::binAxes, and are drawn without the geometry shader.
+void Application::rasterizeVoxels(Scene::Filter filter, const glm::vec3 &boxMin, float voxelSize, int resolution, const glm::mat4 *cull) {
+	float extent = 0.5f * resolution * voxelSize;
+	glm::vec3 center = boxMin + extent;
+
+	glViewport(0, 0, resolution, resolution);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDepthMask(GL_FALSE);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	if (GLAD_GL_NV_conservative_raster && settings.conservativeRasterization) {
+		glEnable(GL_CONSERVATIVE_RASTERIZATION_NV);
+	}
+
+	glm::mat4 projection = glm::ortho(-extent, extent, -extent, extent, 0.0f, 2.0f * extent);
+	glm::mat4 mvp_x = projection * glm::lookAt(center + glm::vec3(extent, 0, 0), center, glm::vec3(0, 1, 0));
+	glm::mat4 mvp_y = projection * glm::lookAt(center + glm::vec3(0, extent, 0), center, glm::vec3(0, 0, -1));
+	glm::mat4 mvp_z = projection * glm::lookAt(center + glm::vec3(0, 0, extent), center, glm::vec3(0, 1, 0));
+
+	const Light &mainlight = scene->getMainlight();
+
+	setVoxelUniforms([&](GLShaderProgram &p) {
+		p.setUniformMatrix4fv("mvp_x", mvp_x);
+		p.setUniformMatrix4fv("mvp_y", mvp_y);
+		p.setUniformMatrix4fv("mvp_z", mvp_z);
+
+		p.setUniform1i("axis_override", settings.axisOverride);
+		p.setUniform1i("averageAtomics", settings.casAveraging);
+
+		p.setUniform3fv("eye", camera.position);
+		p.setUniform3fv("lightPos", mainlight.position);
+		p.setUniform3fv("lightInt", mainlight.intensity);
+	});
+
+	// The axis override is a geometry shader debug option
+	if (settings.axisBinnedVoxelization && settings.axisOverride < 0) {
+		if (filter != Scene::Filter::Dynamic) {
+			voxelAxisProgram.bind();
+			const glm::mat4 mvps[3] = { mvp_x, mvp_y, mvp_z };
+			for (int axis = 0; axis < 3; axis++) {
+				voxelAxisProgram.setUniformMatrix4fv("mvp", mvps[axis]);
+				voxelAxisProgram.setUniform1i("axis", axis);
+				scene->drawAxis(voxelAxisProgram.getHandle(), axis, cull);
+			}
+		}
+		if (filter != Scene::Filter::Static) {
+			voxelProgram.bind();
+			scene->draw(voxelProgram.getHandle(), cull, Scene::Filter::Dynamic);
+		}
+	}
+	else {
+		voxelProgram.bind();
+		scene->draw(voxelProgram.getHandle(), cull, filter);
+	}
+	voxelProgram.unbind();
+
+	// Restore OpenGL state
+	glViewport(0, 0, width, height);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	if (GLAD_GL_NV_conservative_raster && settings.conservativeRasterization) {
+		glDisable(GL_CONSERVATIVE_RASTERIZATION_NV);
+	}
+}
+
+// Rebuilds the occupancy pyramid from voxelColor, whole, a workgroup per 16^3 region
+void Application::buildOccupancy() {
+	GL_DEBUG_PUSH("Build Occupancy")
+	buildOccupancyProgram.bind();
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	// Empty lists, a 0x1x1 dispatch
+	const GLuint listHeader[4] = { 0, 1, 1, 0 };
+	glNamedBufferSubData(voxelListBuffer, 0, sizeof(listHeader), listHeader);
+	glNamedBufferSubData(brickListBuffer, 0, sizeof(listHeader), listHeader);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, voxelListBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, brickListBuffer);
+
+	glBindImageTexture(0, voxelColor, 0, GL_TRUE, 0, GL_READ_ONLY, useRGBA16f ? GL_RGBA16F : GL_RGBA8);
+	glBindImageTexture(1, occupancyVoxels, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RG32UI);
+	glBindImageTexture(2, occupancyBricks, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RG32UI);
+
+	glm::ivec3 groups = voxelDims / 16;
+	glDispatchCompute(groups.x, groups.y, groups.z);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, 0);
+	// List lengths for the overlay, read back once the frame is done
+	if (voxelListStatsFrame < 0) {
+		glCopyNamedBufferSubData(voxelListBuffer, voxelListStats, 3 * sizeof(GLuint), 0, sizeof(GLuint));
+		glCopyNamedBufferSubData(brickListBuffer, voxelListStats, 3 * sizeof(GLuint), sizeof(GLuint), sizeof(GLuint));
+		voxelListStatsFrame = frame;
+	}
+
+	glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8);
+	glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RG32UI);
+	glBindImageTexture(2, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RG32UI);
+	buildOccupancyProgram.unbind();
+	GL_DEBUG_POP()
+}
+
+// Jump floods the bricks with geometry out over the grid, 1+JFA: a last pass at jump 1 fixes most of the
+// seeds plain jump flooding gets wrong, the field must not overestimate or traces would skip geometry
+void Application::buildDistanceField() {
+	GL_DEBUG_PUSH("Distance Field")
+	distanceFieldProgram.bind();
+	glBindTextureUnit(0, occupancyVoxels);
+	distanceFieldProgram.setUniform1i("occupancyVoxels", 0);
+
+	// Same as distanceField.comp
+	enum { STAGE_INIT, STAGE_FLOOD, STAGE_RESOLVE };
+	glm::ivec3 bricks = voxelDims / 4;
+	glm::ivec3 groups = (bricks + 3) / 4;
+	int current = 0;
+	auto dispatch = [&](int stage, int jump) {
+		distanceFieldProgram.setUniform1i("stage", stage);
+		distanceFieldProgram.setUniform1i("jump", jump);
+		glBindImageTexture(0, distanceSeeds[current], 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI);
+		glBindImageTexture(1, distanceSeeds[1 - current], 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32UI);
+		glDispatchCompute(groups.x, groups.y, groups.z);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		current = 1 - current;
+	};
+
+	dispatch(STAGE_INIT, 0);
+	int maxBricks = std::max(bricks.x, std::max(bricks.y, bricks.z));
+	for (int jump = maxBricks / 2; jump >= 1; jump /= 2) {
+		dispatch(STAGE_FLOOD, jump);
+	}
+	dispatch(STAGE_FLOOD, 1);
+
+	distanceFieldProgram.setUniform1i("stage", STAGE_RESOLVE);
+	glBindImageTexture(0, distanceSeeds[current], 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI);
+	glBindImageTexture(2, distanceField, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R16F);
+	glDispatchCompute(groups.x, groups.y, groups.z);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	for (int unit = 0; unit < 3; unit++) {
+		glBindImageTexture(unit, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI);
+	}
+	glBindTextureUnit(0, 0);
+	distanceFieldProgram.unbind();
+	GL_DEBUG_POP()
+}
+
+// Divides the accumulated color and normal of every listed voxel by their count
+void Application::normalizeVoxelList() {
+	GLShaderProgram *p = &normalizeProgram;
+	p->bind();
+	glBindImageTexture(0, voxelColor, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	glBindImageTexture(1, voxelNormal, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+
+	p->setUniform1i("useVoxelList", true);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, voxelListBuffer);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, voxelListBuffer);
+	glDispatchComputeIndirect(0);
+
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0);
+	p->setUniform1i("useVoxelList", false);
+	glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	p->unbind();
+}
+
+// Reallocates the occupied voxel list with room for capacity voxels, buildOccupancy fills it again
+void Application::resizeVoxelList(GLuint capacity) {
+	glDeleteBuffers(1, &voxelListBuffer);
+	voxelListCapacity = capacity;
+	glCreateBuffers(1, &voxelListBuffer);
+	glNamedBufferStorage(voxelListBuffer, (4 + voxelListCapacity) * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+}
+
+// Divides the accumulated color and normal of a region by their count, the region wraps around the textures
+void Application::normalizeVoxels(GLuint color, GLuint normal, const glm::ivec3 &offset, const glm::ivec3 &size) {
+	GLShaderProgram *p = &normalizeProgram;
+	p->bind();
+	glBindImageTexture(0, color, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	glBindImageTexture(1, normal, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+
+	p->setUniform3i("regionOffset", offset.x, offset.y, offset.z);
+	p->setUniform3i("regionSize", size.x, size.y, size.z);
+	glDispatchCompute((size.x + 4 - 1) / 4, (size.y + 4 - 1) / 4, (size.z + 4 - 1) / 4);
+
+	glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA16F);
+	p->unbind();
+}
+
+// Packs the normals of a region octahedrally into packedVoxelNormal, for the packed storage formats
+void Application::packNormals(const glm::ivec3 &offset, const glm::ivec3 &size) {
+	GLShaderProgram *p = &packNormalsProgram;
+	p->bind();
+	glBindImageTexture(0, voxelNormal, 0, GL_TRUE, 0, GL_READ_ONLY, useRGBA16f ? GL_RGBA16F : GL_RGBA8);
+	glBindImageTexture(1, packedVoxelNormal, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RG8);
+
+	p->setUniform3i("regionOffset", offset.x, offset.y, offset.z);
+	p->setUniform3i("regionSize", size.x, size.y, size.z);
+	glDispatchCompute((size.x + 4 - 1) / 4, (size.y + 4 - 1) / 4, (size.z + 4 - 1) / 4);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA16F);
+	glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RG8);
+	p->unbind();
+}
+
+// Zeroes one radiance level, with its opacity in the packed formats
+void Application::clearRadianceLevel(int level) {
+	glClearTexImage(voxelRadiance, level, GL_RGBA, GL_FLOAT, nullptr);
+	if (packedStorage()) {
+		glClearTexImage(voxelOpacity, level, GL_RED, GL_FLOAT, nullptr);
+	}
+}
+
+// Zeroes radiance levels 0 to 2 ahead of an injection from the current lists, only in the bricks the last one
+// wrote while they are recorded, then records the current brick list in their place
+void Application::clearRadiance() {
+	GL_DEBUG_PUSH("Clear Radiance")
+	if (settings.clearFreeRadiance && radianceBricksValid) {
+		clearBricksProgram.bind();
+		for (int level = 0; level < 3; level++) {
+			bindRadianceImage(level, level + 3, level, GL_WRITE_ONLY);
+		}
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, radianceBricksBuffer);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, radianceBricksBuffer);
+		glDispatchComputeIndirect(0);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, 0);
+		for (int level = 0; level < 3; level++) {
+			bindRadianceImage(level, level + 3, -1, GL_WRITE_ONLY);
+		}
+		clearBricksProgram.unbind();
+	}
+	else {
+		for (int level = 0; level < 3; level++) {
+			clearRadianceLevel(level);
+		}
+	}
+
+	// The copy waits for the dispatch reading the old list
+	glCopyNamedBufferSubData(brickListBuffer, radianceBricksBuffer, 0, 0, (4 + brickListCapacity) * sizeof(GLuint));
+	radianceBricksValid = true;
+	GL_DEBUG_POP()
+}
+
+// Lights every voxel in the occupied voxel list, the list's header is the indirect dispatch size
+void Application::injectVoxels() {
+	GLShaderProgram *p = &injectVoxelsProgram;
+	p->bind();
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	// Only listed voxels are written
+	clearRadiance();
+
+	GLenum voxelFormat = useRGBA16f ? GL_RGBA16F : GL_RGBA8;
+	glBindImageTexture(0, voxelColor, 0, GL_TRUE, 0, GL_READ_ONLY, voxelFormat);
+	glBindImageTexture(1, packedStorage() ? packedVoxelNormal : voxelNormal, 0, GL_TRUE, 0, GL_READ_ONLY, packedStorage() ? GL_RG8 : voxelFormat);
+	bindRadianceImage(2, 3, 0, GL_WRITE_ONLY);
+
+	glBindTextureUnit(1, shadowmapFBO.getTexture(0));
+	p->setUniform1i("shadowmap", 1);
+	p->setUniformMatrix4fv("shadowMatrices", shadowMatrices, MAX_SHADOW_CASCADES + 1);
+	p->setUniform1i("shadowCascades", settings.shadowCascades);
+
+	const Light &light = scene->getMainlight();
+	p->setUniform3fv("voxelMin", voxelMin);
+	p->setUniform1f("voxelSize", voxelSize);
+	p->setUniform3fv("lightPos", light.position);
+	p->setUniform3fv("lightInt", light.intensity);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, voxelListBuffer);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, voxelListBuffer);
+	glDispatchComputeIndirect(0);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0);
+	glBindTextureUnit(1, 0);
+	glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA16F);
+	glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA16F);
+	bindRadianceImage(2, 3, -1, GL_WRITE_ONLY);
+	p->unbind();
+}
+
+// One dispatch per level from firstLevel up, each reading the one before
+void Application::filterRadianceLevels(int firstLevel) {
+	mipmapProgram.bind();
+
+	glm::ivec3 dim = voxelDims >> firstLevel;
+	const int local_size = 8;
+	for (int level = firstLevel; level + 1 < voxelLevels; level++) {
+		bindRadianceImage(0, 2, level, GL_READ_ONLY);
+		bindRadianceImage(1, 3, level + 1, GL_WRITE_ONLY);
+
+		glm::ivec3 num_groups = ((dim >> 1) + local_size - 1) / local_size;
+		glDispatchCompute(num_groups.x, num_groups.y, num_groups.z);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		bindRadianceImage(0, 2, -1, GL_READ_ONLY);
+		bindRadianceImage(1, 3, -1, GL_WRITE_ONLY);
+
+		dim >>= 1;
+	}
+
+	mipmapProgram.unbind();
+}
+
+// Lights the clipmap voxels in each region with the cascaded shadowmap
+void Application::injectClipmap(const std::vector<VoxelClipmap::Region> &regions) {
+	GLShaderProgram *p = &injectClipmapProgram;
+	p->bind();
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	glBindTextureUnit(1, shadowmapFBO.getTexture(0));
+	p->setUniform1i("shadowmap", 1);
+	p->setUniformMatrix4fv("shadowMatrices", shadowMatrices, MAX_SHADOW_CASCADES + 1);
+	p->setUniform1i("shadowCascades", settings.shadowCascades);
+	const Light &light = scene->getMainlight();
+	p->setUniform3fv("lightPos", light.position);
+	p->setUniform3fv("lightInt", light.intensity);
+
+	GLenum voxelFormat = useRGBA16f ? GL_RGBA16F : GL_RGBA8;
+	for (const auto &region : regions) {
+		glBindImageTexture(0, clipmap.getColor(region.level), 0, GL_TRUE, 0, GL_READ_ONLY, voxelFormat);
+		glBindImageTexture(1, clipmap.getNormal(region.level), 0, GL_TRUE, 0, GL_READ_ONLY, voxelFormat);
+		glBindImageTexture(2, clipmap.getRadiance(region.level), 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+		glm::ivec3 size = region.max - region.min;
+		p->setUniform3i("regionOffset", region.min.x, region.min.y, region.min.z);
+		p->setUniform3i("regionSize", size.x, size.y, size.z);
+		p->setUniform1f("clipVoxelSize", clipmap.getVoxelSize(region.level));
+		glDispatchCompute((size.x + 4 - 1) / 4, (size.y + 4 - 1) / 4, (size.z + 4 - 1) / 4);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	glBindTextureUnit(1, 0);
+	glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA16F);
+	glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA16F);
+	glBindImageTexture(2, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	p->unbind();
+}
+
+// Voxel index range [boundsMin, boundsMax) covering a world space box, same mapping as worldToVoxel in the shaders
+void Application::worldToVoxelBounds(const glm::vec3 &min, const glm::vec3 &max, glm::ivec3 &boundsMin, glm::ivec3 &boundsMax) const {
+	glm::vec3 voxelsMin = (min - voxelMin) / voxelSize;
+	glm::vec3 voxelsMax = (max - voxelMin) / voxelSize;
+
+	// One voxel of margin for conservative rasterization
+	boundsMin = glm::clamp(glm::ivec3(glm::floor(voxelsMin)) - 1, glm::ivec3(0), voxelDims);
+	boundsMax = glm::clamp(glm::ivec3(glm::floor(voxelsMax)) + 2, glm::ivec3(0), voxelDims);
+}
+
+// Fits the dense grid around the scene, or the legacy 40 unit cube, with settings.voxelResolution voxels along
+// the longest axis. Reallocates the voxel textures and returns true when the dimensions or bounds changed.
+bool Application::updateVoxelGrid() {
+	// Every dimension is a multiple of the coarsest mip
+	const int alignment = 1 << (voxelLevels - 1);
+	settings.voxelResolution = glm::clamp(settings.voxelResolution / alignment * alignment, 2 * alignment, 512);
+	if (voxelColor
+		&& gridStorage == voxelStorage
+		&& settings.voxelResolution == gridResolution
+		&& settings.fitVoxelGrid == gridFitted
+		&& (!settings.fitVoxelGrid || scene->getStaticVersion() == gridStaticVersion)) {
+		return false;
+	}
+	gridResolution = settings.voxelResolution;
+	gridFitted = settings.fitVoxelGrid;
+	gridStaticVersion = scene->getStaticVersion();
+
+	glm::ivec3 dims(gridResolution);
+	glm::vec3 center(0.0f);
+	float size = 40.0f / gridResolution;
+	if (settings.fitVoxelGrid) {
+		// Static bounds, dynamic nodes move, a voxel of margin on each side of the longest axis
+		glm::vec3 sceneMin, sceneMax;
+		scene->getBounds(sceneMin, sceneMax, Scene::Filter::Static);
+		glm::vec3 extent = sceneMax - sceneMin;
+		center = (sceneMin + sceneMax) * 0.5f;
+		size = std::max(extent.x, std::max(extent.y, extent.z)) / (gridResolution - 2);
+		dims = glm::ivec3(glm::ceil(extent / size)) + 2;
+		dims = glm::min((dims + alignment - 1) / alignment * alignment, glm::ivec3(gridResolution));
+	}
+	glm::vec3 min = center - glm::vec3(dims) * size * 0.5f;
+	if (voxelColor && gridStorage == voxelStorage && dims == voxelDims && size == voxelSize && min == voxelMin) {
+		return false;
+	}
+	voxelDims = dims;
+	voxelSize = size;
+	voxelMin = min;
+
+	for (GLuint texture : { voxelColor, voxelNormal, voxelRadiance, voxelOpacity, packedVoxelNormal, staticVoxelColor, staticVoxelNormal,
+		occupancyVoxels, occupancyBricks, distanceField, distanceSeeds[0], distanceSeeds[1] }) {
+		if (texture) {
+			glDeleteTextures(1, &texture);
+		}
+	}
+	GLenum voxelFormat = useRGBA16f ? GL_RGBA16F : GL_RGBA8;
+	voxelColor = make3DTexture(voxelDims, 1, voxelFormat, GL_LINEAR, GL_NEAREST);
+	voxelNormal = make3DTexture(voxelDims, 1, voxelFormat, GL_NEAREST, GL_NEAREST);
+	voxelRadiance = make3DTexture(voxelDims, voxelLevels, radianceFormat(), GL_LINEAR_MIPMAP_LINEAR, GL_NEAREST);
+	voxelOpacity = packedStorage() ? make3DTexture(voxelDims, voxelLevels, GL_R8, GL_LINEAR_MIPMAP_LINEAR, GL_NEAREST) : 0;
+	packedVoxelNormal = packedStorage() ? make3DTexture(voxelDims, 1, GL_RG8, GL_NEAREST, GL_NEAREST) : 0;
+	gridStorage = voxelStorage;
+	// Unnormalized static nodes only, voxelColor and voxelNormal are rebuilt from these plus the dynamic nodes
+	staticVoxelColor = make3DTexture(voxelDims, 1, voxelFormat, GL_NEAREST, GL_NEAREST);
+	staticVoxelNormal = make3DTexture(voxelDims, 1, voxelFormat, GL_NEAREST, GL_NEAREST);
+	// Integer textures are only complete with nearest filtering
+	for (GLuint *occupancy : { &occupancyVoxels, &occupancyBricks }) {
+		glm::ivec3 size = voxelDims / (occupancy == &occupancyVoxels ? 4 : 16);
+		glCreateTextures(GL_TEXTURE_3D, 1, occupancy);
+		glTextureParameteri(*occupancy, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTextureParameteri(*occupancy, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTextureStorage3D(*occupancy, 1, GL_RG32UI, size.x, size.y, size.z);
+	}
+	glm::ivec3 bricks = voxelDims / 4;
+	glCreateTextures(GL_TEXTURE_3D, 1, &distanceField);
+	glTextureParameteri(distanceField, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTextureParameteri(distanceField, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTextureStorage3D(distanceField, 1, GL_R16F, bricks.x, bricks.y, bricks.z);
+	glCreateTextures(GL_TEXTURE_3D, 2, distanceSeeds);
+	for (GLuint seeds : distanceSeeds) {
+		glTextureStorage3D(seeds, 1, GL_R32UI, bricks.x, bricks.y, bricks.z);
+	}
+
+	// Room for a quarter of the grid, grown once a rebuild reads back more, see render
+	size_t voxelCount = (size_t)voxelDims.x * voxelDims.y * voxelDims.z;
+	resizeVoxelList((GLuint)std::min(voxelCount / 4, (size_t)MAX_LISTED_VOXELS));
+	voxelListsOverflowed = false;
+	// Counts copied from the old lists
+	voxelListStatsFrame = -1;
+	// Every brick fits unless a dispatch of 8 brick groups can not cover them
+	glDeleteBuffers(1, &brickListBuffer);
+	brickListCapacity = (GLuint)std::min(voxelCount / 64, (size_t)MAX_LISTED_BRICKS);
+	glCreateBuffers(1, &brickListBuffer);
+	glNamedBufferStorage(brickListBuffer, (4 + brickListCapacity) * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+	// New radiance texture is all zero, nothing recorded to clear
+	glDeleteBuffers(1, &radianceBricksBuffer);
+	glCreateBuffers(1, &radianceBricksBuffer);
+	glNamedBufferStorage(radianceBricksBuffer, (4 + brickListCapacity) * sizeof(GLuint), nullptr, 0);
+	radianceBricksValid = false;
+
+	LOG_INFO(
+		"Voxel grid ", voxelDims.x, "x", voxelDims.y, "x", voxelDims.z,
+		", voxel size ", voxelSize, ", ", VOXEL_STORAGE_NAMES[voxelStorage], ", ", voxelGridMemory() / (1024.0 * 1024.0), " MB"
+	);
+	return true;
+}
+
+// World space to the dense grid's [0, 1] texture coordinates
+glm::mat4 Application::worldToVoxel() const {
+	glm::vec3 extent = glm::vec3(voxelDims) * voxelSize;
+	return glm::scale(glm::mat4(1.0f), 1.0f / extent) * glm::translate(glm::mat4(1.0f), -voxelMin);
+}
+
+// Bytes held by the dense grid's textures, the radiance mip chain included
+size_t Application::voxelGridMemory() const {
+	size_t voxels = (size_t)voxelDims.x * voxelDims.y * voxelDims.z;
+	// Radiance is 4 bytes per texel in every format, the packed ones add a byte of opacity and 2 bytes of normal
+	size_t radiance = 0;
+	for (int level = 0; level < voxelLevels; level++) {
+		radiance += (size_t)(voxelDims.x >> level) * (voxelDims.y >> level) * (voxelDims.z >> level) * (packedStorage() ? 5 : 4);
+	}
+	size_t packedNormals = packedStorage() ? 2 * voxels : 0;
+	// Color, normal and their static copies, less the normals while they are dropped
+	size_t fullTextures = 2 + (voxelNormal ? 1 : 0) + (staticVoxelNormal ? 1 : 0);
+	// Occupancy is a bit per voxel plus a bit per 4^3 brick
+	size_t occupancy = voxels / 8 + voxels / 64 / 8;
+	// Distance field and its two seed textures, per 4^3 brick
+	size_t distance = voxels / 64 * (2 + 2 * 4);
+	size_t voxelList = (12 + (size_t)voxelListCapacity + 2 * (size_t)brickListCapacity) * sizeof(GLuint);
+	return fullTextures * voxels * (useRGBA16f ? 8 : 4) + radiance + packedNormals + occupancy + distance + voxelList;
+}
+
+// Has every shader recompiled for storage, the grid is reallocated with it by the next updateVoxelGrid and refilled.
+// Programs reload on the main thread, so switching stalls for a moment.
+void Application::setVoxelStorage(int storage) {
+	voxelStorage = glm::clamp(storage, 0, VOXEL_STORAGE_COUNT - 1);
+	settings.voxelStorage = voxelStorage;
+	voxelsDirty = true;
+	radianceDirty = true;
+	mipsDirty = true;
+	GLHelper::setShaderDefines("#define VOXEL_STORAGE " + std::to_string(voxelStorage) + "\n");
+	for (GLShaderProgram *p : programs) {
+		p->reload();
+	}
+	LOG_INFO("Voxel storage ", VOXEL_STORAGE_NAMES[voxelStorage]);
+}
+
+GLenum Application::radianceFormat() const {
+	switch (voxelStorage) {
+	case VOXEL_STORAGE_RGB10A2:
+		return GL_RGB10_A2;
+	case VOXEL_STORAGE_R11G11B10F:
+		return GL_R11F_G11F_B10F;
+	default:
+		return GL_RGBA8;
+	}
+}
+
+// Binds a radiance level as an image to unit and, in the packed formats, its opacity to opacityUnit.
+// A negative level unbinds both.
+void Application::bindRadianceImage(GLuint unit, GLuint opacityUnit, GLint level, GLenum access) {
+	glBindImageTexture(unit, level < 0 ? 0 : voxelRadiance, std::max(level, 0), GL_TRUE, 0, access, radianceFormat());
+	if (packedStorage()) {
+		glBindImageTexture(opacityUnit, level < 0 ? 0 : voxelOpacity, std::max(level, 0), GL_TRUE, 0, access, GL_R8);
+	}
+}
+
+// (Re)allocates the shadowmap arrays and their debug views at size^2, one layer per cascade plus a last layer
+// covering the voxel volume. Every cached layer is redrawn and radiance injected again from the new map.
+void Application::allocateShadowmaps(int size) {
+	shadowmapSize = size;
+	if (shadowmapLayerViews[0] != 0) {
+		glDeleteTextures(MAX_SHADOW_CASCADES + 1, shadowmapLayerViews);
+	}
+	shadowmapFBO.deleteAttachments();
+	staticShadowmapFBO.deleteAttachments();
+
+	shadowmapFBO.bind();
+	glm::vec4 borderColor{ 1.0f };
+	shadowmapFBO.attachTextureArray(
+		GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT32F,
+		size, size, MAX_SHADOW_CASCADES + 1,
+		GL_LINEAR, GL_LINEAR,
+		GL_CLAMP_TO_BORDER, GL_CLAMP_TO_BORDER,
+		&borderColor
+	);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (shadowmapFBO.getStatus() != GL_FRAMEBUFFER_COMPLETE) {
+		LOG_ERROR("shadowmapFBO not created successfully");
+	}
+	shadowmapFBO.unbind();
+
+	// Static casters only, composited with dynamic ones into shadowmapFBO when the scene has any
+	staticShadowmapFBO.bind();
+	staticShadowmapFBO.attachTextureArray(
+		GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT32F,
+		size, size, MAX_SHADOW_CASCADES + 1
+	);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (staticShadowmapFBO.getStatus() != GL_FRAMEBUFFER_COMPLETE) {
+		LOG_ERROR("staticShadowmapFBO not created successfully");
+	}
+	staticShadowmapFBO.unbind();
+
+	// 2D views of each layer for the debug view
+	glGenTextures(MAX_SHADOW_CASCADES + 1, shadowmapLayerViews);
+	for (int i = 0; i <= MAX_SHADOW_CASCADES; i++) {
+		glTextureView(shadowmapLayerViews[i], GL_TEXTURE_2D, shadowmapFBO.getTexture(0), GL_DEPTH_COMPONENT32F, 0, 1, i, 1);
+	}
+
+	// Regions are snapped to texels of the old size
+	std::fill(std::begin(shadowRegions), std::end(shadowRegions), ShadowRegion());
+	std::fill(std::begin(shadowCacheValid), std::end(shadowCacheValid), false);
+	radianceDirty = true;
+	clipmapDirty = true;
+	LOG_INFO("Shadowmap ", size, "x", size);
+}
+
+// Fits settings.shadowCascades orthographic cascades around slices of the view frustum, split between
+// uniform and logarithmic, and the last layer around the voxel volume
+void Application::fitShadowCascades(const glm::mat4 &lightView) {
+	// Every caster has to fit in each cascade's depth range, so depth comes from the scene bounds along the light
+	glm::vec3 sceneMin, sceneMax;
+	scene->getBounds(sceneMin, sceneMax);
+	float lightNear = std::numeric_limits<float>::max(), lightFar = -std::numeric_limits<float>::max();
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner(i & 1 ? sceneMax.x : sceneMin.x, i & 2 ? sceneMax.y : sceneMin.y, i & 4 ? sceneMax.z : sceneMin.z);
+		float depth = -(lightView * glm::vec4(corner, 1.0f)).z;
+		lightNear = std::min(lightNear, depth);
+		lightFar = std::max(lightFar, depth);
+	}
+
+	glm::mat4 view = camera.lookAt();
+	float aspect = (float)width / height;
+	float shadowFar = std::min(far, settings.shadowDistance);
+	int cascades = glm::clamp(settings.shadowCascades, 1, MAX_SHADOW_CASCADES);
+
+	float splitNear = near;
+	for (int i = 0; i < cascades; i++) {
+		float t = (float)(i + 1) / cascades;
+		float logSplit = near * std::pow(shadowFar / near, t);
+		float uniformSplit = near + (shadowFar - near) * t;
+		float splitFar = glm::mix(uniformSplit, logSplit, settings.cascadeSplitLambda);
+
+		glm::mat4 inverseSlice = glm::inverse(glm::perspective(camera.fov, aspect, splitNear, splitFar) * view);
+		glm::vec3 corners[8];
+		glm::vec3 center(0.0f);
+		for (int j = 0; j < 8; j++) {
+			glm::vec4 corner = inverseSlice * glm::vec4(j & 1 ? 1.0f : -1.0f, j & 2 ? 1.0f : -1.0f, j & 4 ? 1.0f : -1.0f, 1.0f);
+			corners[j] = glm::vec3(corner) / corner.w;
+			center += corners[j] / 8.0f;
+		}
+
+		// A bounding sphere keeps the cascade size constant as the camera rotates
+		float radius = 0.0f;
+		for (const glm::vec3 &corner : corners) {
+			radius = std::max(radius, glm::length(corner - center));
+		}
+		radius = std::ceil(radius * 16.0f) / 16.0f;
+
+		// With cached shadows the cascade covers a square SHADOW_CACHE_MARGIN times wider than the slice and deeper
+		// than the scene, kept until the slice or a caster leaves it, so moving or turning the camera reuses the
+		// cached depth. Without caching the square fits the slice and follows it texel by texel.
+		ShadowRegion &region = shadowRegions[i];
+		float regionRadius = settings.cacheShadows ? radius * SHADOW_CACHE_MARGIN : radius;
+		glm::vec2 lightCenter = glm::vec2(lightView * glm::vec4(center, 1.0f));
+		glm::vec2 offset = glm::abs(lightCenter - region.center);
+		if (lightView != shadowRegionView || regionRadius != region.radius
+			|| std::max(offset.x, offset.y) + radius > regionRadius
+			|| lightNear < region.near || lightFar > region.far) {
+			// Snap to whole texels so edges do not shimmer, in steps of at most half the margin so the slice
+			// starts inside
+			float texelSize = 2.0f * regionRadius / shadowmapSize;
+			float step = std::max(texelSize, std::floor((regionRadius - radius) * 0.5f / texelSize) * texelSize);
+			region.center.x = std::floor(lightCenter.x / step) * step;
+			region.center.y = std::floor(lightCenter.y / step) * step;
+			region.radius = regionRadius;
+			float depthMargin = settings.cacheShadows ? (SHADOW_CACHE_MARGIN - 1.0f) * (lightFar - lightNear) : 0.0f;
+			region.near = lightNear - depthMargin;
+			region.far = lightFar + depthMargin;
+		}
+
+		glm::mat4 lp = glm::ortho(
+			region.center.x - region.radius, region.center.x + region.radius,
+			region.center.y - region.radius, region.center.y + region.radius,
+			region.near, region.far
+		);
+		shadowMatrices[i] = lp * lightView;
+		splitNear = splitFar;
+	}
+	shadowRegionView = lightView;
+
+	// Voxel volume, same extent as the voxelization projection. The clipmap is far larger than the scene,
+	// so only the part of it with geometry is covered, which also keeps the layer still as the camera moves.
+	glm::vec3 boxMin = voxelMin, boxMax = voxelMin + glm::vec3(voxelDims) * voxelSize;
+	if (settings.clipmap && clipmap.isInitialized()) {
+		clipmap.getBounds(boxMin, boxMax);
+		boxMin = glm::max(boxMin, sceneMin);
+		boxMax = glm::min(boxMax, sceneMax);
+	}
+	glm::vec2 volumeMin(std::numeric_limits<float>::max()), volumeMax(-std::numeric_limits<float>::max());
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner(i & 1 ? boxMax.x : boxMin.x, i & 2 ? boxMax.y : boxMin.y, i & 4 ? boxMax.z : boxMin.z);
+		glm::vec2 lightCorner = glm::vec2(lightView * glm::vec4(corner, 1.0f));
+		volumeMin = glm::min(volumeMin, lightCorner);
+		volumeMax = glm::max(volumeMax, lightCorner);
+	}
+	shadowMatrices[MAX_SHADOW_CASCADES] = glm::ortho(volumeMin.x, volumeMax.x, volumeMin.y, volumeMax.y, lightNear, lightFar) * lightView;
+}
+
 // Dirty function that renders a texture to a full screen quad.
 void view2DTexture(GLuint texture) {
 	static const GLchar *vert =
@@ -467,52 +1974,34 @@ void view2DTexture(GLuint texture) {
 }
 
 void Application::viewRaymarched() {
-	static const GLchar *vert =
-		"#version 330\n"
-		"layout(location = 0) in vec3 pos;\n"
-		"layout(location = 1) in vec2 tc;\n"
-		"out vec2 fragTexcoord;\n"
-		"void main() {\n"
-		"gl_Position = vec4(pos, 1);\n"
-		"fragTexcoord = tc;\n"
-		"}\n";
-
-	static GLuint program = 0;
-	if (program == 0) {
-		GLuint shaders[2];
-		shaders[0] = GLHelper::createShaderFromString(GL_VERTEX_SHADER, vert);
-		shaders[1] = GLHelper::createShaderFromFile(GL_FRAGMENT_SHADER, SHADER_DIR "raymarch.frag");
-		program = glCreateProgram();
-		glAttachShader(program, shaders[0]);
-		glAttachShader(program, shaders[1]);
-		glLinkProgram(program);
-		if (!GLHelper::checkShaderProgramStatus(program)) {
-			LOG_ERROR("Raymarch debug shader compilation failed");
-		}
-	}
-
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glUseProgram(program);
+	raymarchProgram.bind();
 
 	glBindTextureUnit(0, voxelColor);
-	glBindTextureUnit(1, voxelNormal);
+	glBindTextureUnit(1, packedStorage() ? packedVoxelNormal : voxelNormal);
 	glBindTextureUnit(2, voxelRadiance);
+	glBindTextureUnit(3, occupancyBricks);
+	glBindTextureUnit(4, distanceField);
+	glBindTextureUnit(5, voxelOpacity);
 
 	glm::vec3 cameraRight = glm::normalize(glm::cross(camera.front, camera.up)) * ((float)width / height);
 
-	glUniform3fv(glGetUniformLocation(program, "eye"), 1, glm::value_ptr(camera.position));
-	glUniform3fv(glGetUniformLocation(program, "viewForward"), 1, glm::value_ptr(camera.front));
-	glUniform3fv(glGetUniformLocation(program, "viewRight"), 1, glm::value_ptr(cameraRight));
-	glUniform3fv(glGetUniformLocation(program, "viewUp"), 1, glm::value_ptr(glm::normalize(glm::cross(cameraRight, camera.front))));
-	glUniform1i(glGetUniformLocation(program, "width"), width);
-	glUniform1i(glGetUniformLocation(program, "height"), height);
-	glUniform1f(glGetUniformLocation(program, "near"), near);
-	glUniform1f(glGetUniformLocation(program, "far"), far);
-	glUniform1i(glGetUniformLocation(program, "voxelDim"), voxelDim);
-	glUniform1i(glGetUniformLocation(program, "lod"), settings.miplevel);
-	
+	raymarchProgram.setUniform3fv("eye", camera.position);
+	raymarchProgram.setUniform3fv("viewForward", camera.front);
+	raymarchProgram.setUniform3fv("viewRight", cameraRight);
+	raymarchProgram.setUniform3fv("viewUp", glm::normalize(glm::cross(cameraRight, camera.front)));
+	raymarchProgram.setUniform1i("width", width);
+	raymarchProgram.setUniform1i("height", height);
+	raymarchProgram.setUniform1f("near", near);
+	raymarchProgram.setUniform1f("far", far);
+	raymarchProgram.setUniformMatrix4fv("worldToVoxel", worldToVoxel());
+	raymarchProgram.setUniform1i("lod", settings.miplevel);
+	raymarchProgram.setUniform1i("occupancyBricks", 3);
+	raymarchProgram.setUniform1i("useOccupancy", settings.occupancySkipping);
+	raymarchProgram.setUniform1i("distanceField", 4);
+	raymarchProgram.setUniform1i("useDistanceField", settings.distanceField);
 
 	GLQuad::draw();
 
-	glUseProgram(0);
+	raymarchProgram.unbind();
 }
@@ -13,6 +13,7 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <functional>
 
 #include "Graphics/GLHelper.h"
 #include "Graphics/GLShaderProgram.h"
@@ -21,10 +22,20 @@
 #include "Overlay.h"
 #include "Camera.h"
 #include "Scene.h"
+#include "FileWatcher.h"
+#include "VoxelClipmap.h"
+#include "SparseVoxelOctree.h"
+#include "VoxelFragmentSort.h"
+#include "ComputeVoxelizer.h"
 #include "Graphics/GLTimer.h"
 
 #include "common.h"
 
+// Dense grid storage formats, VOXEL_STORAGE in voxelStorage.glsl. The packed ones keep the radiance opacity in a
+// separate R8 texture and the normals octahedral in RG8.
+enum VoxelStorage { VOXEL_STORAGE_RGBA8, VOXEL_STORAGE_RGB10A2, VOXEL_STORAGE_R11G11B10F, VOXEL_STORAGE_COUNT };
+static const char *const VOXEL_STORAGE_NAMES[VOXEL_STORAGE_COUNT] = { "RGBA8", "RGB10A2 + R8", "R11G11B10F + R8" };
+
 struct Settings {
     int drawNormals = false;
     int drawDominantAxis = false;
@@ -34,10 +45,34 @@ struct Settings {
     int drawAxes = false;
 	int axisOverride = -1;
     int drawShadowmap = false;
+    int shadowmapLayer = 0;
     int raymarch = false;
 
+    int deferred = false;
+    int depthPrepass = false;
+    // Deferred only, trace indirect lighting at 1/indirectScale resolution or in a checkerboard
+    int reducedIndirect = false;
+    int indirectScale = 2;
+    int checkerboardIndirect = false;
+    // Deferred only, trace temporalCones side cones per frame and accumulate over time
+    int temporalIndirect = false;
+    int temporalCones = 2;
+    float temporalBlend = 0.1f;
+
 	int conservativeRasterization = true;
+	int skipUnchangedGI = true;
 	int enableShadows = true;
+	int cacheShadows = true;
+	// Move the nanosuit, the one dynamic node, every frame
+	int animateNanosuit = false;
+	int shadowCascades = 3;
+	float shadowDistance = 50.0f;
+	// 0 splits the view distance evenly, 1 logarithmically
+	float cascadeSplitLambda = 0.75f;
+	// Width and height of every layer. 4096 keeps the voxel volume layer, which per texel injection reads and
+	// everything past the last cascade falls back to, as sharp as the single map was. Each layer costs size^2 * 8
+	// bytes with the static copy, 2048 cuts that and the fill rate to a quarter where cascades cover the view.
+	int shadowmapSize = 4096;
     int enableNormalMap = true;
     int enableIndirect = true;
     int enableDiffuse = true;
@@ -51,6 +86,47 @@ struct Settings {
     float vctBias = 1.0f;
     float vctConeInitialHeight = 1.0f;
     float vctLodOffset = 0.1f;
+
+    // Scale cone count, steps and distance per pixel, spending at most coneBudget samples
+    int adaptiveCones = false;
+    float coneBudget = 48.0f;
+
+    // Trace a camera centered clipmap instead of the fixed voxel volume
+    int clipmap = false;
+    // Trace a sparse voxel octree 2^octreeDepth voxels across instead of the dense volume
+    int sparseOctree = false;
+    int octreeDepth = 9;
+
+    // Fit the dense grid to the scene bounds instead of the fixed 40 unit cube, voxelResolution voxels
+    // along the longest axis
+    int fitVoxelGrid = true;
+    int voxelResolution = 128;
+    // Build the radiance mips in one dispatch instead of one per level
+    int singlePassMips = true;
+    // Skip empty bricks in the mip filter, cone tracer and raymarcher using the occupancy pyramid
+    int occupancySkipping = true;
+    // Sphere trace the raymarch view and cones through a per brick distance field
+    int distanceField = true;
+    // Inject radiance per occupied voxel instead of per shadowmap texel
+    int voxelInjection = true;
+    // Normalize and filter only the voxels and bricks in the occupied lists, dispatched indirectly
+    int activeVoxelLists = true;
+    // Zero only the radiance bricks the last injection wrote instead of clearing the whole texture
+    int clearFreeRadiance = true;
+    // Voxelize the dense grid through a Morton sorted fragment list averaged per voxel. Opt in, it keeps no
+    // static grid, so every rebuild, a dynamic node moving included, voxelizes the whole scene.
+    int sortedVoxelization = false;
+    // Without fp16 atomics and the sorted list, average with a compare and swap loop instead of the maximum
+    int casAveraging = false;
+    // Voxelize the dense grid with separating axis tests in compute instead of rasterizing, conservative everywhere
+    int computeVoxelization = false;
+    // Draw static triangles binned by dominant axis when they were added, three draws without a geometry shader
+    int axisBinnedVoxelization = true;
+    // Dense grid storage, see VoxelStorage. Changing it recompiles every shader and reallocates the grid.
+    int voxelStorage = VOXEL_STORAGE_RGBA8;
+    // Packed storage only, release the full voxel normals and their static copy once they are packed while
+    // there are no dynamic nodes. The next rebuild reallocates both and voxelizes the static grid again.
+    int dropVoxelNormal = false;
 };
 
 class Application {
@@ -71,22 +147,173 @@ private:
     float near = 0.1f, far = 100.0f;
 
     std::unique_ptr<Scene> scene = nullptr;
+    size_t nanosuitNode = 0;
+    float nanosuitAngle = 0.0f;
     GLShaderProgram program;
     
     GLShaderProgram voxelProgram;
-    int voxelDim = 128, voxelLevels = 6;
+    // Same outputs without the geometry shader, for static triangles binned by dominant axis
+    GLShaderProgram voxelAxisProgram;
+    // Dense grid of voxelDims voxels, voxelSize wide on every axis, starting at voxelMin in world space.
+    // Each dimension is a multiple of 1 << (voxelLevels - 1) so every mip halves evenly.
+    glm::ivec3 voxelDims{128};
+    glm::vec3 voxelMin{-20.0f};
+    float voxelSize = 40.0f / 128;
+    int voxelLevels = 6;
+    // Inputs the grid was last fitted with
+    int gridResolution = 0, gridFitted = -1;
+    unsigned int gridStaticVersion = 0;
     GLuint voxelColor = 0, voxelNormal = 0, voxelRadiance = 0;
+    GLuint staticVoxelColor = 0, staticVoxelNormal = 0;
+    // Storage the shaders were compiled for and the one the grid was allocated with
+    int voxelStorage = -1, gridStorage = -1;
+    // Packed storage only, radiance opacity with the radiance levels and octahedral normals
+    GLuint voxelOpacity = 0, packedVoxelNormal = 0;
+    GLShaderProgram packNormalsProgram;
+    // Bit per voxel packed per 4^3 brick and bit per brick packed per 16^3 region, see occupancy.glsl
+    GLuint occupancyVoxels = 0, occupancyBricks = 0;
+    GLShaderProgram buildOccupancyProgram;
+    // Occupied voxels with their indirect dispatch size, see voxelList.glsl
+    GLuint voxelListBuffer = 0, brickListBuffer = 0;
+    GLuint voxelListCapacity = 0, brickListCapacity = 0;
+    // A list was longer than one indirect dispatch covers, normalization, injection and mips use the full grid
+    // instead until the grid is reallocated
+    bool voxelListsOverflowed = false;
+    // List lengths copied after a rebuild and read back a frame later
+    GLuint voxelListStats = 0;
+    int voxelListStatsFrame = -1;
+    GLuint listedVoxels = 0, listedBricks = 0;
+    GLShaderProgram filterBricksProgram;
+    // Brick list as of the last per voxel injection, the only bricks with radiance in levels 0 to 2.
+    // Invalid after a full clear or any other writer, the next injection then clears the whole texture.
+    GLuint radianceBricksBuffer = 0;
+    bool radianceBricksValid = false;
+    GLShaderProgram clearBricksProgram;
+    GLShaderProgram injectVoxelsProgram;
+    // Distance per 4^3 brick to the nearest geometry, jump flooded through the two seed textures
+    GLuint distanceField = 0, distanceSeeds[2] = { 0, 0 };
+    GLShaderProgram distanceFieldProgram;
+    // Voxels covered by dynamic nodes when they were last voxelized
+    glm::ivec3 dynamicVoxelMin{0}, dynamicVoxelMax{0};
     bool useRGBA16f;
 
+	// Allocated the first time settings.clipmap is enabled
+	VoxelClipmap clipmap;
+	GLShaderProgram injectClipmapProgram;
+	bool clipmapDirty = true;
+	int clipmapVoxelsUpdated = 0;
+	SparseVoxelOctree octree;
+	bool octreeDirty = true;
+	// Allocated the first time settings.sortedVoxelization is enabled
+	VoxelFragmentSort fragmentSort;
+	// Allocated the first time settings.computeVoxelization is enabled
+	ComputeVoxelizer computeVoxelizer;
+
+	static constexpr int MAX_SHADOW_CASCADES = 4;
 	GLFramebuffer shadowmapFBO;
 	GLShaderProgram shadowmapProgram;
+	// Light view-projection per cascade, the last one covers the voxel volume for radiance injection
+	glm::mat4 shadowMatrices[MAX_SHADOW_CASCADES + 1];
+	GLuint shadowmapLayerViews[MAX_SHADOW_CASCADES + 1] = {};
+	// Size the shadowmap arrays were allocated with
+	int shadowmapSize = 0;
+	// Cached static caster depth, a layer is redrawn when its matrix or the static geometry changes
+	GLFramebuffer staticShadowmapFBO;
+	glm::mat4 cachedShadowMatrices[MAX_SHADOW_CASCADES + 1];
+	bool shadowCacheValid[MAX_SHADOW_CASCADES + 1] = {};
+	unsigned int cachedStaticVersion = 0;
+	bool cachedComposite = false;
+	int shadowLayersDrawn = 0;
+	// Light space square and depth range each cascade was last fitted to, with the light view they are in
+	struct ShadowRegion {
+		glm::vec2 center{0.0f};
+		float radius = 0.0f, near = 0.0f, far = 0.0f;
+	};
+	ShadowRegion shadowRegions[MAX_SHADOW_CASCADES];
+	glm::mat4 shadowRegionView;
 
+	// Deferred path: albedo, normal, tangent, shading normal and depth, lit by a compute pass into deferredFBO
+	GLFramebuffer gbufferFBO, deferredFBO, indirectFBO;
+	GLShaderProgram gbufferProgram;
+	GLShaderProgram indirectLightingProgram;
+	GLFramebuffer historyFBO;
+	GLShaderProgram temporalIndirectProgram;
+	int historyIndex = 0;
+	bool historyValid = false;
+	glm::mat4 prevViewProjection;
+	int frame = 0;
+	GLShaderProgram deferredShadingProgram;
+
+	GLShaderProgram normalizeProgram;
 	GLShaderProgram injectRadianceProgram;
 
     GLShaderProgram mipmapProgram;
+    GLShaderProgram mipmapSinglePassProgram;
+    // Workgroups of the single pass done so far, the last one resets it
+    GLuint mipCounterBuffer = 0;
+
+    GLShaderProgram raymarchProgram;
+
+    // Every program above, for polling async compiles and hot reloading
+    std::vector<GLShaderProgram *> programs;
+    FileWatcher shaderWatcher;
 
     Settings settings;
-	GLBufferedTimer voxelizeTimer, shadowmapTimer, radianceTimer, mipmapTimer, renderTimer, totalTimer;
+
+	// Inputs the GI passes last ran with, see the start of render()
+	struct GIInputs {
+		unsigned int sceneVersion = 0, staticVersion = 0;
+		int axisOverride = -1;
+		int conservativeRasterization = true;
+		Light light = {};
+	};
+	GIInputs giInputs;
+	bool voxelsDirty = true, radianceDirty = true, mipsDirty = true;
+	bool voxelizeSkipped = false, normalizeSkipped = false, radianceSkipped = false, mipmapSkipped = false;
+	// Cone samples and traced pixels, counted only while the overlay shows them. Read through persistent maps once
+	// the frame's fence has signaled, frames that find every buffer in flight skip counting.
+	static const int CONE_SAMPLE_BUFFERS = 3;
+	GLuint coneSampleBuffers[CONE_SAMPLE_BUFFERS] = {};
+	const GLuint *coneSampleCounts[CONE_SAMPLE_BUFFERS] = {};
+	GLsync coneSampleFences[CONE_SAMPLE_BUFFERS] = {};
+	int coneSampleIndex = 0;
+	// Set by the overlay each frame it shows the readout, coneStatsRecording when this frame counts
+	bool coneStats = false, coneStatsRecording = false;
+	float samplesPerTracedPixel = 0.0f, samplesPerPixel = 0.0f, samplesSavedPerPixel = 0.0f;
+
+	GLBufferedTimer voxelizeTimer, normalizeTimer, shadowmapTimer, radianceTimer, mipmapTimer, renderTimer, indirectTimer, totalTimer;
+
+    void voxelizeScene(Scene::Filter filter, GLuint color, GLuint normal, const VoxelClipmap::Region *region = nullptr);
+    void voxelizeFragments(int depth);
+    void voxelizeSorted();
+    void voxelizeCompute(Scene::Filter filter, GLuint color, GLuint normal, bool sortedFragments);
+    void compareCPUVoxelization();
+    void compareCPUMips();
+    bool updateVoxelGrid();
+    glm::mat4 worldToVoxel() const;
+    size_t voxelGridMemory() const;
+    void setVoxelStorage(int storage);
+    bool packedStorage() const { return voxelStorage != VOXEL_STORAGE_RGBA8; }
+    GLenum radianceFormat() const;
+    void bindRadianceImage(GLuint unit, GLuint opacityUnit, GLint level, GLenum access);
+    void clearRadianceLevel(int level);
+    void packNormals(const glm::ivec3 &offset, const glm::ivec3 &size);
+    void setVoxelUniforms(const std::function<void(GLShaderProgram &p)> &set);
+    void rasterizeVoxels(Scene::Filter filter, const glm::vec3 &boxMin, float voxelSize, int resolution, const glm::mat4 *cull);
+    void buildOccupancy();
+    void buildDistanceField();
+    void resizeVoxelList(GLuint capacity);
+    void normalizeVoxelList();
+    void normalizeVoxels(GLuint color, GLuint normal, const glm::ivec3 &offset, const glm::ivec3 &size);
+    void clearRadiance();
+    void injectVoxels();
+    void filterRadianceLevels(int firstLevel);
+    void injectClipmap(const std::vector<VoxelClipmap::Region> &regions);
+    void worldToVoxelBounds(const glm::vec3 &min, const glm::vec3 &max, glm::ivec3 &voxelMin, glm::ivec3 &voxelMax) const;
+    void allocateShadowmaps(int size);
+    void fitShadowCascades(const glm::mat4 &lightView);
+    void bindShadingInputs(GLShaderProgram &p, const Light &light);
+    void unbindShadingInputs();
 
     void viewRaymarched();
 };
@@ -0,0 +1,357 @@
+#include "CPUMipPyramid.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// MSVC does not define __SSE2__, x64 always has it. VCT_CPU_SCALAR builds the plain C++ paths instead.
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(VCT_CPU_SCALAR)
+#define MIP_SSE2 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Outputs a thread takes at a time from a MORTON level
+const size_t MORTON_BLOCK = 4096;
+
+// Bit exact half conversions, rounding to nearest even
+float halfToFloat(uint16_t h) {
+	uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+	uint32_t exponent = (h >> 10) & 0x1Fu, mantissa = h & 0x3FFu;
+	uint32_t bits;
+	if (exponent == 0) {
+		float f = std::ldexp((float)mantissa, -24);
+		std::memcpy(&bits, &f, sizeof(bits));
+		bits |= sign;
+	}
+	else if (exponent == 31) {
+		bits = sign | 0x7F800000u | (mantissa << 13);
+	}
+	else {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	float f;
+	std::memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+uint16_t floatToHalf(float f) {
+	uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	uint16_t sign = (uint16_t)((bits >> 16) & 0x8000u);
+	bits &= 0x7FFFFFFFu;
+	if (bits >= 0x7F800000u) {
+		return sign | (bits > 0x7F800000u ? 0x7E00u : 0x7C00u);
+	}
+	// 65520 and up round to infinity
+	if (bits >= 0x477FF000u) {
+		return sign | 0x7C00u;
+	}
+	// Subnormal halves, adding 0.5 leaves the float ulp at the half's 2^-24 so the add rounds for us
+	if (bits < 0x38800000u) {
+		float magic = 0.5f, sum;
+		std::memcpy(&sum, &bits, sizeof(sum));
+		sum += magic;
+		uint32_t sumBits, magicBits;
+		std::memcpy(&sumBits, &sum, sizeof(sumBits));
+		std::memcpy(&magicBits, &magic, sizeof(magicBits));
+		return sign | (uint16_t)(sumBits - magicBits);
+	}
+	uint32_t odd = (bits >> 13) & 1u;
+	bits += ((uint32_t)(15 - 127) << 23) + 0xFFFu + odd;
+	return sign | (uint16_t)(bits >> 13);
+}
+
+// A texel's 4 channels in float, one SSE register where available. Both paths do the same IEEE operations in the
+// same order, so they agree bit for bit.
+#ifdef MIP_SSE2
+typedef __m128 Texel;
+
+inline Texel zero() { return _mm_setzero_ps(); }
+inline Texel add(Texel a, Texel b) { return _mm_add_ps(a, b); }
+inline Texel scale(Texel a, float s) { return _mm_mul_ps(a, _mm_set1_ps(s)); }
+
+inline Texel load(const unsigned char *p, CPUMipPyramid::Format format) {
+	if (format == CPUMipPyramid::RGBA8) {
+		int packed;
+		std::memcpy(&packed, p, sizeof(packed));
+		__m128i bytes = _mm_cvtsi32_si128(packed);
+		__m128i words = _mm_unpacklo_epi8(bytes, _mm_setzero_si128());
+		__m128i ints = _mm_unpacklo_epi16(words, _mm_setzero_si128());
+		return _mm_div_ps(_mm_cvtepi32_ps(ints), _mm_set1_ps(255.0f));
+	}
+#ifdef __F16C__
+	return _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)p));
+#else
+	uint16_t h[4];
+	std::memcpy(h, p, sizeof(h));
+	return _mm_setr_ps(halfToFloat(h[0]), halfToFloat(h[1]), halfToFloat(h[2]), halfToFloat(h[3]));
+#endif
+}
+
+inline void store(unsigned char *p, Texel v, CPUMipPyramid::Format format) {
+	if (format == CPUMipPyramid::RGBA8) {
+		// Clamped like a unorm image store, _mm_cvtps_epi32 rounds to nearest even
+		v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+		__m128i ints = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(255.0f)));
+		__m128i words = _mm_packs_epi32(ints, ints);
+		int packed = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+		std::memcpy(p, &packed, sizeof(packed));
+		return;
+	}
+#ifdef __F16C__
+	_mm_storel_epi64((__m128i *)p, _mm_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+#else
+	float f[4];
+	_mm_storeu_ps(f, v);
+	uint16_t h[4] = { floatToHalf(f[0]), floatToHalf(f[1]), floatToHalf(f[2]), floatToHalf(f[3]) };
+	std::memcpy(p, h, sizeof(h));
+#endif
+}
+
+inline Texel colorMask() { return _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)); }
+
+// Color times alpha, alpha as it is
+inline Texel weight(Texel t) {
+	Texel w = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3, 3, 3, 3));
+	w = _mm_or_ps(_mm_and_ps(w, colorMask()), _mm_andnot_ps(colorMask(), _mm_set1_ps(1.0f)));
+	return _mm_mul_ps(t, w);
+}
+
+inline float alpha(Texel t) {
+	return _mm_cvtss_f32(_mm_shuffle_ps(t, t, _MM_SHUFFLE(3, 3, 3, 3)));
+}
+#else
+typedef glm::vec4 Texel;
+
+inline Texel zero() { return Texel(0.0f); }
+inline Texel add(const Texel &a, const Texel &b) { return a + b; }
+inline Texel scale(const Texel &a, float s) { return a * s; }
+
+inline Texel load(const unsigned char *p, CPUMipPyramid::Format format) {
+	if (format == CPUMipPyramid::RGBA8) {
+		return Texel(p[0] / 255.0f, p[1] / 255.0f, p[2] / 255.0f, p[3] / 255.0f);
+	}
+	uint16_t h[4];
+	std::memcpy(h, p, sizeof(h));
+	return Texel(halfToFloat(h[0]), halfToFloat(h[1]), halfToFloat(h[2]), halfToFloat(h[3]));
+}
+
+inline void store(unsigned char *p, const Texel &v, CPUMipPyramid::Format format) {
+	if (format == CPUMipPyramid::RGBA8) {
+		for (int i = 0; i < 4; i++) {
+			p[i] = (unsigned char)std::nearbyint(std::min(std::max(v[i], 0.0f), 1.0f) * 255.0f);
+		}
+		return;
+	}
+	uint16_t h[4] = { floatToHalf(v.x), floatToHalf(v.y), floatToHalf(v.z), floatToHalf(v.w) };
+	std::memcpy(p, h, sizeof(h));
+}
+
+// Color times alpha, alpha as it is
+inline Texel weight(const Texel &t) { return Texel(t.x * t.w, t.y * t.w, t.z * t.w, t.w); }
+inline float alpha(const Texel &t) { return t.w; }
+#endif
+
+// Sum of the weighted children back to an average
+inline Texel unweight(Texel sum) {
+	float a = alpha(sum);
+	if (a <= 0.0f)
+		return zero();
+	Texel color = scale(sum, 1.0f / a);
+#ifdef MIP_SSE2
+	return _mm_or_ps(_mm_and_ps(color, colorMask()), _mm_setr_ps(0.0f, 0.0f, 0.0f, a * 0.125f));
+#else
+	return Texel(color.x, color.y, color.z, a * 0.125f);
+#endif
+}
+
+// The order filterRadiance.comp sums them in, z lowest
+inline glm::ivec3 childOffset(int i) {
+	return glm::ivec3(i >> 2, (i >> 1) & 1, i & 1);
+}
+
+// Reduces the 8 texels at src, children[i] bytes apart, into dst
+inline void reduce(const unsigned char *src, const size_t *children, int count, unsigned char *dst, CPUMipPyramid::Format format, CPUMipBuilder::Filter filter) {
+	Texel sum = zero();
+	for (int i = 0; i < count; i++) {
+		Texel t = load(src + children[i], format);
+		sum = add(sum, filter == CPUMipBuilder::BOX ? t : weight(t));
+	}
+	store(dst, filter == CPUMipBuilder::BOX ? scale(sum, 0.125f) : unweight(sum), format);
+}
+
+// Runs work(slab) for every slab across up to threads threads
+template<typename Work>
+void parallelSlabs(int threads, size_t slabs, const Work &work) {
+	std::atomic<size_t> nextSlab(0);
+	auto run = [&]() {
+		for (size_t slab = nextSlab++; slab < slabs; slab = nextSlab++) {
+			work(slab);
+		}
+	};
+	std::vector<std::thread> workers;
+	for (int i = 1; i < (int)std::min<size_t>(threads, slabs); i++) {
+		workers.emplace_back(run);
+	}
+	run();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+}
+
+}
+
+size_t CPUMipPyramid::index(int level, const glm::ivec3 &voxel) const {
+	if (layout == MORTON)
+		return mortonIndex(voxel);
+	glm::ivec3 size = levelDims(level);
+	return ((size_t)voxel.z * size.y + voxel.y) * size.x + voxel.x;
+}
+
+glm::vec4 CPUMipPyramid::load(int level, const glm::ivec3 &voxel) const {
+	glm::ivec3 size = levelDims(level);
+	if (level < 0 || level >= (int)levels.size() || !glm::all(glm::lessThan(glm::ivec3(-1), voxel)) || !glm::all(glm::lessThan(voxel, size)))
+		return glm::vec4(0.0f);
+	const unsigned char *p = &levels[level][index(level, voxel) * texelSize()];
+	if (format == RGBA8)
+		return glm::vec4(p[0], p[1], p[2], p[3]) / 255.0f;
+	uint16_t h[4];
+	std::memcpy(h, p, sizeof(h));
+	return glm::vec4(halfToFloat(h[0]), halfToFloat(h[1]), halfToFloat(h[2]), halfToFloat(h[3]));
+}
+
+bool CPUMipPyramid::supportsMorton(const glm::ivec3 &dims) {
+	// 10 bits per axis fill the 32 bit index
+	return dims.x == dims.y && dims.y == dims.z && dims.x > 0 && dims.x <= 1024 && (dims.x & (dims.x - 1)) == 0;
+}
+
+uint32_t CPUMipPyramid::mortonIndex(const glm::ivec3 &voxel) {
+	uint32_t index = 0;
+	for (int bit = 0; bit < 10; bit++) {
+		index |= (((uint32_t)voxel.z >> bit) & 1u) << (3 * bit);
+		index |= (((uint32_t)voxel.y >> bit) & 1u) << (3 * bit + 1);
+		index |= (((uint32_t)voxel.x >> bit) & 1u) << (3 * bit + 2);
+	}
+	return index;
+}
+
+bool CPUMipPyramid::setLayout(Layout newLayout) {
+	if (newLayout == layout)
+		return true;
+	if (newLayout == MORTON && !supportsMorton(dims))
+		return false;
+
+	size_t size = texelSize();
+	for (int level = 0; level < (int)levels.size(); level++) {
+		glm::ivec3 levelSize = levelDims(level);
+		std::vector<unsigned char> reordered(levels[level].size());
+		size_t linear = 0;
+		for (int z = 0; z < levelSize.z; z++) {
+			for (int y = 0; y < levelSize.y; y++) {
+				for (int x = 0; x < levelSize.x; x++, linear++) {
+					size_t morton = mortonIndex(glm::ivec3(x, y, z));
+					size_t from = newLayout == MORTON ? linear : morton, to = newLayout == MORTON ? morton : linear;
+					std::memcpy(&reordered[to * size], &levels[level][from * size], size);
+				}
+			}
+		}
+		levels[level].swap(reordered);
+	}
+	layout = newLayout;
+	return true;
+}
+
+CPUMipBuilder::CPUMipBuilder(int threads) : threads(threads) {
+	if (this->threads <= 0) {
+		this->threads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+}
+
+bool CPUMipBuilder::usesSSE2() {
+#ifdef MIP_SSE2
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool CPUMipBuilder::usesF16C() {
+#if defined(MIP_SSE2) && defined(__F16C__)
+	return true;
+#else
+	return false;
+#endif
+}
+
+void CPUMipBuilder::build(CPUMipPyramid &pyramid, int levels, Filter filter) const {
+	glm::ivec3 dims = pyramid.dims;
+	int maxDim = std::max(dims.x, std::max(dims.y, dims.z));
+	int fullChain = 1;
+	while ((maxDim >> fullChain) > 0) {
+		fullChain++;
+	}
+	levels = std::min(levels, fullChain);
+	size_t texelSize = pyramid.texelSize();
+	if (pyramid.levels.empty() || pyramid.levels[0].size() != (size_t)dims.x * dims.y * dims.z * texelSize || levels < 1)
+		return;
+	if (pyramid.layout == CPUMipPyramid::MORTON && !CPUMipPyramid::supportsMorton(dims))
+		return;
+
+	pyramid.levels.resize(levels);
+	for (int level = 1; level < levels; level++) {
+		glm::ivec3 srcSize = pyramid.levelDims(level - 1), dstSize = pyramid.levelDims(level);
+		std::vector<unsigned char> &dstLevel = pyramid.levels[level];
+		dstLevel.assign((size_t)dstSize.x * dstSize.y * dstSize.z * texelSize, 0);
+		const unsigned char *src = pyramid.levels[level - 1].data();
+		unsigned char *dst = dstLevel.data();
+		CPUMipPyramid::Format format = pyramid.format;
+
+		if (pyramid.layout == CPUMipPyramid::MORTON) {
+			// The children of output m are texels 8m to 8m + 7 of the level below
+			const size_t children[8] = { 0, texelSize, 2 * texelSize, 3 * texelSize, 4 * texelSize, 5 * texelSize, 6 * texelSize, 7 * texelSize };
+			size_t count = (size_t)dstSize.x * dstSize.y * dstSize.z;
+			parallelSlabs(threads, (count + MORTON_BLOCK - 1) / MORTON_BLOCK, [&](size_t block) {
+				size_t end = std::min(count, (block + 1) * MORTON_BLOCK);
+				for (size_t m = block * MORTON_BLOCK; m < end; m++) {
+					reduce(src + 8 * m * texelSize, children, 8, dst + m * texelSize, format, filter);
+				}
+			});
+			continue;
+		}
+
+		size_t children[8];
+		for (int i = 0; i < 8; i++) {
+			glm::ivec3 o = childOffset(i);
+			children[i] = (((size_t)o.z * srcSize.y + o.y) * srcSize.x + o.x) * texelSize;
+		}
+		// A z slab of the output per task
+		parallelSlabs(threads, (size_t)dstSize.z, [&](size_t slab) {
+			int z = (int)slab;
+			size_t edgeChildren[8];
+			for (int y = 0; y < dstSize.y; y++) {
+				for (int x = 0; x < dstSize.x; x++) {
+					glm::ivec3 s = 2 * glm::ivec3(x, y, z);
+					const unsigned char *first = src + (((size_t)s.z * srcSize.y + s.y) * srcSize.x + s.x) * texelSize;
+					unsigned char *out = dst + (((size_t)z * dstSize.y + y) * dstSize.x + x) * texelSize;
+					if (glm::all(glm::lessThan(s + 1, srcSize))) {
+						reduce(first, children, 8, out, format, filter);
+						continue;
+					}
+					// Odd sizes, children past the edge load 0 on the GPU and add nothing
+					int count = 0;
+					for (int i = 0; i < 8; i++) {
+						if (glm::all(glm::lessThan(s + childOffset(i), srcSize))) {
+							edgeChildren[count++] = children[i];
+						}
+					}
+					reduce(first, edgeChildren, count, out, format, filter);
+				}
+			}
+		});
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef CPUMIPPYRAMID_H
+#define CPUMIPPYRAMID_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Mip chain of an RGBA 3D texture in host memory. LINEAR levels are laid out x fastest like glGetTextureImage
+// returns them. MORTON levels interleave the coordinate bits with z lowest, so the 2x2x2 children of a voxel
+// are 8 consecutive texels in the order filterRadiance.comp sums them. It needs cubic power of two dims.
+struct CPUMipPyramid {
+	enum Format { RGBA8, RGBA16F };
+	enum Layout { LINEAR, MORTON };
+
+	glm::ivec3 dims = glm::ivec3(0);
+	Format format = RGBA8;
+	Layout layout = LINEAR;
+	// Level 0 first, texelSize() bytes per texel
+	std::vector<std::vector<unsigned char>> levels;
+
+	glm::ivec3 levelDims(int level) const { return glm::max(dims >> level, glm::ivec3(1)); }
+	size_t texelSize() const { return format == RGBA8 ? 4 : 8; }
+	size_t index(int level, const glm::ivec3 &voxel) const;
+
+	// Unorm or half texel converted to float, 0 outside the level like imageLoad
+	glm::vec4 load(int level, const glm::ivec3 &voxel) const;
+
+	// Reorders every level, false when MORTON is asked for dims it does not support
+	bool setLayout(Layout layout);
+
+	static bool supportsMorton(const glm::ivec3 &dims);
+	static uint32_t mortonIndex(const glm::ivec3 &voxel);
+};
+
+// Builds the levels above the first of a CPUMipPyramid on the CPU, for grids that were baked or voxelized without
+// the GPU and as an oracle for the GPU filters. BOX averages each 2x2x2 block like filterRadiance.comp, summing in
+// the same order in float and rounding RGBA8 to nearest even on store, so a chain filtered level by level on the
+// GPU matches it bit for bit. OPACITY_WEIGHTED averages color by alpha for grids that are not premultiplied.
+// Threads take z slabs of each level in turn, or runs of Morton codes, and reduce each voxel's 4 channels in one
+// SSE register.
+class CPUMipBuilder {
+public:
+	enum Filter { BOX, OPACITY_WEIGHTED };
+
+	// 0 threads uses one per hardware thread
+	explicit CPUMipBuilder(int threads = 0);
+
+	CPUMipBuilder(const CPUMipBuilder &other) = delete;
+	CPUMipBuilder &operator=(const CPUMipBuilder &other) = delete;
+
+	// Replaces levels 1 to levels - 1 from level 0, levels is clamped to the full chain
+	void build(CPUMipPyramid &pyramid, int levels, Filter filter = BOX) const;
+
+	int getThreadCount() const { return threads; }
+	// Whether the reductions were compiled with SSE2, and the half conversions with F16C
+	static bool usesSSE2();
+	static bool usesF16C();
+
+private:
+	int threads;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "CPUVoxelizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+// VCT_CPU_SCALAR builds the plain C++ paths whatever the compiler targets, the tests check both agree
+#if defined(__AVX2__) && !defined(VCT_CPU_SCALAR)
+#define VOXELIZE_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Rows are tested this many voxels at a time
+const int ROW_WIDTH = 8;
+const int SAT_AXES = 13;
+
+struct Triangle {
+	// Voxel coordinates
+	glm::vec3 p[3];
+	glm::vec3 normal[3];
+	glm::vec2 texcoord[3];
+	const CPUImage *diffuse;
+	// Voxels the triangle's bounds cover, clamped to the grid
+	glm::ivec3 lo, hi;
+};
+
+// Separating axes of a triangle against a voxel: the box normals, the triangle normal and the 9 edge cross
+// products. A voxel with center c is separated on an axis when [min, max] - dot(c, axis) misses [-radius, radius].
+struct SATTable {
+	glm::vec3 axis[SAT_AXES];
+	float min[SAT_AXES], max[SAT_AXES], radius[SAT_AXES];
+};
+
+void buildSATTable(const Triangle &t, SATTable &table) {
+	glm::vec3 edges[3] = { t.p[1] - t.p[0], t.p[2] - t.p[1], t.p[0] - t.p[2] };
+	int n = 0;
+	for (int j = 0; j < 3; j++) {
+		table.axis[n++] = glm::vec3(j == 0, j == 1, j == 2);
+	}
+	table.axis[n++] = glm::cross(edges[0], edges[1]);
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			table.axis[n++] = glm::cross(glm::vec3(j == 0, j == 1, j == 2), edges[i]);
+		}
+	}
+	for (int a = 0; a < SAT_AXES; a++) {
+		const glm::vec3 &axis = table.axis[a];
+		float p0 = glm::dot(t.p[0], axis), p1 = glm::dot(t.p[1], axis), p2 = glm::dot(t.p[2], axis);
+		table.min[a] = std::min(p0, std::min(p1, p2));
+		table.max[a] = std::max(p0, std::max(p1, p2));
+		table.radius[a] = 0.5f * (std::abs(axis.x) + std::abs(axis.y) + std::abs(axis.z));
+	}
+}
+
+// Bit i set when voxel (x + i, y, z) overlaps the triangle, for the first count voxels of the row. The dot
+// products are summed in the same order on both paths so they agree bit for bit.
+unsigned testRow(const SATTable &table, int x, int y, int z, int count) {
+	float cy = y + 0.5f, cz = z + 0.5f;
+#ifdef VOXELIZE_AVX2
+	__m256 cx = _mm256_add_ps(_mm256_set1_ps(x + 0.5f), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256 separated = _mm256_setzero_ps();
+	for (int a = 0; a < SAT_AXES; a++) {
+		const glm::vec3 &axis = table.axis[a];
+		__m256 d = _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(axis.x)), _mm256_set1_ps(cy * axis.y + cz * axis.z));
+		__m256 below = _mm256_cmp_ps(_mm256_sub_ps(_mm256_set1_ps(table.min[a]), d), _mm256_set1_ps(table.radius[a]), _CMP_GT_OQ);
+		__m256 above = _mm256_cmp_ps(_mm256_sub_ps(_mm256_set1_ps(table.max[a]), d), _mm256_set1_ps(-table.radius[a]), _CMP_LT_OQ);
+		separated = _mm256_or_ps(separated, _mm256_or_ps(below, above));
+	}
+	unsigned mask = ~(unsigned)_mm256_movemask_ps(separated) & 0xFFu;
+#else
+	unsigned mask = 0;
+	for (int i = 0; i < ROW_WIDTH; i++) {
+		float cx = x + i + 0.5f;
+		bool separated = false;
+		for (int a = 0; a < SAT_AXES && !separated; a++) {
+			const glm::vec3 &axis = table.axis[a];
+			float d = cx * axis.x + (cy * axis.y + cz * axis.z);
+			separated = table.min[a] - d > table.radius[a] || table.max[a] - d < -table.radius[a];
+		}
+		mask |= separated ? 0u : 1u << i;
+	}
+#endif
+	return mask & ((1u << count) - 1u);
+}
+
+// Nearest texel of the base level with GL_REPEAT, the textures' magnification filter
+glm::vec3 sampleNearest(const CPUImage &image, const glm::vec2 &uv) {
+	glm::vec2 wrapped = uv - glm::floor(uv);
+	int x = std::min((int)(wrapped.x * image.width), image.width - 1);
+	int y = std::min((int)(wrapped.y * image.height), image.height - 1);
+	const unsigned char *texel = &image.pixels[4 * ((size_t)y * image.width + x)];
+	return glm::vec3(texel[0], texel[1], texel[2]) / 255.0f;
+}
+
+// Same as writeVoxel in voxelizeCompute.comp, adding to the voxel's sums with the count in alpha
+void writeVoxel(const glm::ivec3 &voxel, const Triangle &t, CPUVoxelGrid &grid) {
+	glm::vec3 center = glm::vec3(voxel) + 0.5f;
+	glm::vec3 e0 = t.p[1] - t.p[0], e1 = t.p[2] - t.p[0], d = center - t.p[0];
+	float d00 = glm::dot(e0, e0), d01 = glm::dot(e0, e1), d11 = glm::dot(e1, e1);
+	float denominator = std::max(d00 * d11 - d01 * d01, 1e-12f);
+	float v = (d11 * glm::dot(d, e0) - d01 * glm::dot(d, e1)) / denominator;
+	float w = (d00 * glm::dot(d, e1) - d01 * glm::dot(d, e0)) / denominator;
+	glm::vec3 barycentric = glm::max(glm::vec3(1.0f - v - w, v, w), glm::vec3(0.0f));
+	barycentric /= barycentric.x + barycentric.y + barycentric.z;
+
+	glm::vec3 color(1.0f);
+	if (t.diffuse && t.diffuse->width > 0 && t.diffuse->height > 0) {
+		glm::vec2 texcoord = barycentric.x * t.texcoord[0] + barycentric.y * t.texcoord[1] + barycentric.z * t.texcoord[2];
+		color = sampleNearest(*t.diffuse, texcoord);
+	}
+	glm::vec3 normal = glm::normalize(barycentric.x * t.normal[0] + barycentric.y * t.normal[1] + barycentric.z * t.normal[2]);
+
+	size_t index = grid.index(voxel);
+	grid.color[index] += glm::vec4(color, 1.0f);
+	grid.normal[index] += glm::vec4(normal, 1.0f);
+}
+
+}
+
+constexpr int CPUVoxelizer::TILE_SIZE;
+
+CPUVoxelizer::CPUVoxelizer(int threads) : threads(threads) {
+	if (this->threads <= 0) {
+		this->threads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+}
+
+bool CPUVoxelizer::usesAVX2() {
+#ifdef VOXELIZE_AVX2
+	return true;
+#else
+	return false;
+#endif
+}
+
+void CPUVoxelizer::voxelize(const std::vector<CPUTriangles> &meshes, const glm::ivec3 &dims, const glm::vec3 &min, float voxelSize, CPUVoxelGrid &grid) const {
+	grid.dims = dims;
+	grid.min = min;
+	grid.voxelSize = voxelSize;
+	size_t voxels = (size_t)dims.x * dims.y * dims.z;
+	grid.color.assign(voxels, glm::vec4(0.0f));
+	grid.normal.assign(voxels, glm::vec4(0.0f));
+	if (voxels == 0)
+		return;
+
+	// Voxel space triangles, in order so every voxel sums them in the same order whatever the thread count
+	std::vector<Triangle> triangles;
+	for (const CPUTriangles &mesh : meshes) {
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(mesh.model)));
+		for (size_t i = 0; i < mesh.triangleCount; i++) {
+			Triangle t;
+			for (int v = 0; v < 3; v++) {
+				const float *vertex = mesh.vertices + mesh.indices[3 * i + v] * mesh.vertexStride;
+				glm::vec4 position = mesh.model * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f);
+				t.p[v] = (glm::vec3(position) - min) / voxelSize;
+				t.normal[v] = normalMatrix * glm::vec3(vertex[3], vertex[4], vertex[5]);
+				t.texcoord[v] = glm::vec2(vertex[6], vertex[7]);
+			}
+			t.diffuse = mesh.diffuse;
+			t.lo = glm::max(glm::ivec3(glm::floor(glm::min(glm::min(t.p[0], t.p[1]), t.p[2]))), glm::ivec3(0));
+			t.hi = glm::min(glm::ivec3(glm::floor(glm::max(glm::max(t.p[0], t.p[1]), t.p[2]))), dims - 1);
+			if (t.lo.x <= t.hi.x && t.lo.y <= t.hi.y && t.lo.z <= t.hi.z) {
+				triangles.push_back(t);
+			}
+		}
+	}
+
+	// Tiles own their voxels, so threads never write the same one
+	glm::ivec3 tiles = (dims + TILE_SIZE - 1) / TILE_SIZE;
+	std::vector<std::vector<uint32_t>> tileTriangles((size_t)tiles.x * tiles.y * tiles.z);
+	for (size_t i = 0; i < triangles.size(); i++) {
+		glm::ivec3 lo = triangles[i].lo / TILE_SIZE, hi = triangles[i].hi / TILE_SIZE;
+		for (int z = lo.z; z <= hi.z; z++) {
+			for (int y = lo.y; y <= hi.y; y++) {
+				for (int x = lo.x; x <= hi.x; x++) {
+					tileTriangles[((size_t)z * tiles.y + y) * tiles.x + x].push_back((uint32_t)i);
+				}
+			}
+		}
+	}
+
+	std::atomic<size_t> nextTile(0);
+	auto work = [&]() {
+		SATTable table;
+		for (size_t tile = nextTile++; tile < tileTriangles.size(); tile = nextTile++) {
+			if (tileTriangles[tile].empty())
+				continue;
+			int tileIndex = (int)tile;
+			glm::ivec3 tileMin = TILE_SIZE * glm::ivec3(tileIndex % tiles.x, (tileIndex / tiles.x) % tiles.y, tileIndex / (tiles.x * tiles.y));
+			glm::ivec3 tileMax = glm::min(tileMin + TILE_SIZE, dims) - 1;
+			for (uint32_t i : tileTriangles[tile]) {
+				const Triangle &t = triangles[i];
+				glm::ivec3 lo = glm::max(t.lo, tileMin), hi = glm::min(t.hi, tileMax);
+				buildSATTable(t, table);
+				for (int z = lo.z; z <= hi.z; z++) {
+					for (int y = lo.y; y <= hi.y; y++) {
+						for (int x = lo.x; x <= hi.x; x += ROW_WIDTH) {
+							unsigned mask = testRow(table, x, y, z, std::min(ROW_WIDTH, hi.x - x + 1));
+							for (int bit = 0; mask != 0; bit++, mask >>= 1) {
+								if (mask & 1u) {
+									writeVoxel(glm::ivec3(x + bit, y, z), t, grid);
+								}
+							}
+						}
+					}
+				}
+			}
+
+			// Divide by the count like normalizeVoxels.comp, alpha ends up 1
+			for (int z = tileMin.z; z <= tileMax.z; z++) {
+				for (int y = tileMin.y; y <= tileMax.y; y++) {
+					for (int x = tileMin.x; x <= tileMax.x; x++) {
+						size_t index = grid.index(glm::ivec3(x, y, z));
+						if (grid.color[index].w > 0.0f) {
+							grid.color[index] /= grid.color[index].w;
+							grid.normal[index] /= grid.normal[index].w;
+						}
+					}
+				}
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threads; i++) {
+		workers.emplace_back(work);
+	}
+	work();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef CPUVOXELIZER_H
+#define CPUVOXELIZER_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// RGBA8 texels, rows in the order they were loaded (bottom first with stbi_set_flip_vertically_on_load)
+struct CPUImage {
+	int width = 0, height = 0;
+	std::vector<unsigned char> pixels;
+};
+
+// One drawable's triangles in object space. Vertices are interleaved like Vertex in Graphics/Mesh.h, position,
+// normal and texcoord first, vertexStride floats apart.
+struct CPUTriangles {
+	const float *vertices = nullptr;
+	size_t vertexStride = 14;
+	const uint32_t *indices = nullptr;
+	size_t triangleCount = 0;
+	glm::mat4 model = glm::mat4(1.0f);
+	// Sampled for the voxel color, white without one
+	const CPUImage *diffuse = nullptr;
+};
+
+// Dense grid laid out x fastest like the GPU textures. color and normal hold the averages of every triangle
+// overlapping the voxel with alpha 1, 0 in empty voxels, as the RGBA16F path holds them after normalizeVoxels.comp.
+struct CPUVoxelGrid {
+	glm::ivec3 dims = glm::ivec3(0);
+	glm::vec3 min = glm::vec3(0.0f);
+	float voxelSize = 1.0f;
+	std::vector<glm::vec4> color, normal;
+
+	size_t index(const glm::ivec3 &voxel) const { return ((size_t)voxel.z * dims.y + voxel.y) * dims.x + voxel.x; }
+};
+
+// Conservative voxelization without a GL context, the same separating axis test voxelizeCompute.comp runs and
+// the same shading from the point of the triangle closest to each voxel center. Triangles are binned into
+// 16^3 tiles that threads take in turn, each tile testing its triangles against rows of 8 voxels at a time
+// (AVX2 when compiled with it). Textures are sampled nearest from their base level where the GPU picks a mip
+// for minified ones, and sums are kept in float rather than fp16, so colors differ slightly while coverage matches.
+class CPUVoxelizer {
+public:
+	// 0 threads uses one per hardware thread
+	explicit CPUVoxelizer(int threads = 0);
+
+	CPUVoxelizer(const CPUVoxelizer &other) = delete;
+	CPUVoxelizer &operator=(const CPUVoxelizer &other) = delete;
+
+	// Grid of dims voxels voxelSize wide from min in world space, see Application::worldToVoxel
+	void voxelize(const std::vector<CPUTriangles> &meshes, const glm::ivec3 &dims, const glm::vec3 &min, float voxelSize, CPUVoxelGrid &grid) const;
+
+	int getThreadCount() const { return threads; }
+	// Whether the row tests were compiled with AVX2
+	static bool usesAVX2();
+
+	static constexpr int TILE_SIZE = 16;
+
+private:
+	int threads;
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "CPUTests.h"
+
+#include "CPU/CPUMipPyramid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Hash of every level testRandomChains builds, the same for every library variant
+const uint32_t RANDOM_CHAINS_HASH = 459033023u;
+
+CPUMipPyramid makePyramid(const glm::ivec3 &dims, CPUMipPyramid::Format format) {
+	CPUMipPyramid pyramid;
+	pyramid.dims = dims;
+	pyramid.format = format;
+	pyramid.levels.resize(1);
+	pyramid.levels[0].resize((size_t)dims.x * dims.y * dims.z * pyramid.texelSize());
+	return pyramid;
+}
+
+// Random texels, halves kept finite
+void fillRandom(CPUMipPyramid &pyramid, TestRandom &random) {
+	std::vector<unsigned char> &texels = pyramid.levels[0];
+	for (size_t i = 0; i < texels.size(); i++) {
+		texels[i] = (unsigned char)random.next();
+		if (pyramid.format == CPUMipPyramid::RGBA16F && (i & 1)) {
+			texels[i] &= 0xFB;
+		}
+	}
+}
+
+// 2x2x2 RGBA8 texels of a linear level 0, listed in the order filterRadiance.comp sums them
+void setBlock(CPUMipPyramid &pyramid, const unsigned char texels[8][4]) {
+	for (int i = 0; i < 8; i++) {
+		glm::ivec3 voxel(i >> 2, (i >> 1) & 1, i & 1);
+		std::memcpy(&pyramid.levels[0][pyramid.index(0, voxel) * 4], texels[i], 4);
+	}
+}
+
+// filterRadiance.comp written out in plain C++ for a linear RGBA8 chain: imageLoad returns 0 outside the level,
+// the 8 loads are summed in order, scaled by 0.125 and stored rounding to nearest even
+std::vector<unsigned char> referenceLevel(const CPUMipPyramid &pyramid, int level) {
+	const glm::ivec3 offsets[] = {
+		glm::ivec3(0, 0, 0), glm::ivec3(0, 0, 1), glm::ivec3(0, 1, 0), glm::ivec3(0, 1, 1),
+		glm::ivec3(1, 0, 0), glm::ivec3(1, 0, 1), glm::ivec3(1, 1, 0), glm::ivec3(1, 1, 1)
+	};
+	glm::ivec3 size = pyramid.levelDims(level);
+	std::vector<unsigned char> texels;
+	for (int z = 0; z < size.z; z++) {
+		for (int y = 0; y < size.y; y++) {
+			for (int x = 0; x < size.x; x++) {
+				glm::vec4 value(0.0f);
+				for (int i = 0; i < 8; i++) {
+					value += pyramid.load(level - 1, 2 * glm::ivec3(x, y, z) + offsets[i]);
+				}
+				value *= 0.125f;
+				for (int c = 0; c < 4; c++) {
+					texels.push_back((unsigned char)std::nearbyint(std::min(std::max(value[c], 0.0f), 1.0f) * 255.0f));
+				}
+			}
+		}
+	}
+	return texels;
+}
+
+// Worked out by hand: the sums are 254.875, 0.5, 45 and 0.375 of 255, so the green tie rounds down to even
+void testRGBA8Block() {
+	const unsigned char texels[8][4] = {
+		{ 255, 1, 10, 0 }, { 255, 1, 20, 0 }, { 255, 1, 30, 0 }, { 255, 1, 40, 0 },
+		{ 255, 0, 50, 0 }, { 255, 0, 60, 0 }, { 255, 0, 70, 0 }, { 254, 0, 80, 3 },
+	};
+	CPUMipPyramid pyramid = makePyramid(glm::ivec3(2), CPUMipPyramid::RGBA8);
+	setBlock(pyramid, texels);
+	CPUMipBuilder(1).build(pyramid, 2);
+	const unsigned char expected[4] = { 255, 0, 45, 0 };
+	CHECK(pyramid.levels.size() == 2 && pyramid.levels[1].size() == 4);
+	CHECK(std::memcmp(pyramid.levels[1].data(), expected, 4) == 0);
+	CHECK(pyramid.levels[1] == referenceLevel(pyramid, 1));
+}
+
+// Whole chains against the reference, with odd sizes and axes that reach 1 before the others. Children past an
+// edge add nothing, as imageLoad returns 0 there.
+void testRGBA8Reference() {
+	TestRandom random(11);
+	for (glm::ivec3 dims : { glm::ivec3(16), glm::ivec3(5, 7, 1), glm::ivec3(9, 5, 3), glm::ivec3(1, 1, 6) }) {
+		CPUMipPyramid pyramid = makePyramid(dims, CPUMipPyramid::RGBA8);
+		fillRandom(pyramid, random);
+		CPUMipBuilder(3).build(pyramid, 16);
+		int maxDim = std::max(dims.x, std::max(dims.y, dims.z));
+		CHECK(pyramid.levels.size() == (size_t)std::log2(maxDim) + 1);
+		for (int level = 1; level < (int)pyramid.levels.size(); level++) {
+			CHECK(pyramid.levels[level] == referenceLevel(pyramid, level));
+		}
+	}
+}
+
+// Halves worked out by hand, covering subnormals, ties to even and the largest finite half
+void testRGBA16FBlocks() {
+	const uint16_t blocks[2][4][8] = {
+		{
+			// 1 ulp of subnormal in all 8 stays 1 ulp, 12 ulp in one is 1.5 ulp and rounds to 2, 4 ulp in one is
+			// half an ulp and rounds to 0, seven 1 + 2^-10 and a 1 average closer to 1 + 2^-10
+			{ 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001 },
+			{ 0x000C, 0, 0, 0, 0, 0, 0, 0 },
+			{ 0x0004, 0, 0, 0, 0, 0, 0, 0 },
+			{ 0x3C00, 0x3C01, 0x3C01, 0x3C01, 0x3C01, 0x3C01, 0x3C01, 0x3C01 },
+		},
+		{
+			// 65504 throughout, 1 ulp in one rounds to 0, -1 throughout, 10 ulp in one is 1.25 ulp and rounds to 1
+			{ 0x7BFF, 0x7BFF, 0x7BFF, 0x7BFF, 0x7BFF, 0x7BFF, 0x7BFF, 0x7BFF },
+			{ 0x0001, 0, 0, 0, 0, 0, 0, 0 },
+			{ 0xBC00, 0xBC00, 0xBC00, 0xBC00, 0xBC00, 0xBC00, 0xBC00, 0xBC00 },
+			{ 0x000A, 0, 0, 0, 0, 0, 0, 0 },
+		},
+	};
+	const uint16_t expected[2][4] = { { 0x0001, 0x0002, 0x0000, 0x3C01 }, { 0x7BFF, 0x0000, 0xBC00, 0x0001 } };
+	for (int b = 0; b < 2; b++) {
+		CPUMipPyramid pyramid = makePyramid(glm::ivec3(2), CPUMipPyramid::RGBA16F);
+		for (int i = 0; i < 8; i++) {
+			glm::ivec3 voxel(i >> 2, (i >> 1) & 1, i & 1);
+			for (int c = 0; c < 4; c++) {
+				std::memcpy(&pyramid.levels[0][pyramid.index(0, voxel) * 8 + 2 * c], &blocks[b][c][i], 2);
+			}
+		}
+		CPUMipBuilder(1).build(pyramid, 2);
+		uint16_t result[4];
+		std::memcpy(result, pyramid.levels[1].data(), sizeof(result));
+		CHECK(std::memcmp(result, expected[b], sizeof(result)) == 0);
+	}
+}
+
+// Color averages by alpha, voxels without any stay empty whatever color their children hold
+void testOpacityWeighted() {
+	const unsigned char transparent[8][4] = {
+		{ 255, 10, 0, 0 }, { 20, 255, 0, 0 }, { 0, 30, 255, 0 }, { 40, 0, 0, 0 },
+		{ 0, 50, 0, 0 }, { 0, 0, 60, 0 }, { 70, 70, 70, 0 }, { 80, 0, 80, 0 },
+	};
+	const unsigned char oneOpaque[8][4] = {
+		{ 255, 10, 0, 0 }, { 20, 255, 0, 0 }, { 0, 30, 255, 0 }, { 40, 0, 0, 0 },
+		{ 200, 100, 50, 255 }, { 0, 0, 60, 0 }, { 70, 70, 70, 0 }, { 80, 0, 80, 0 },
+	};
+	const unsigned char expectedTransparent[4] = { 0, 0, 0, 0 }, expectedOneOpaque[4] = { 200, 100, 50, 32 };
+
+	CPUMipPyramid pyramid = makePyramid(glm::ivec3(2), CPUMipPyramid::RGBA8);
+	setBlock(pyramid, transparent);
+	CPUMipBuilder(1).build(pyramid, 2, CPUMipBuilder::OPACITY_WEIGHTED);
+	CHECK(std::memcmp(pyramid.levels[1].data(), expectedTransparent, 4) == 0);
+
+	pyramid = makePyramid(glm::ivec3(2), CPUMipPyramid::RGBA8);
+	setBlock(pyramid, oneOpaque);
+	CPUMipBuilder(1).build(pyramid, 2, CPUMipBuilder::OPACITY_WEIGHTED);
+	CHECK(std::memcmp(pyramid.levels[1].data(), expectedOneOpaque, 4) == 0);
+}
+
+// Morton and linear chains hold the same texels, and so do 1 and several threads
+void testMortonLayout() {
+	CPUMipPyramid odd = makePyramid(glm::ivec3(12, 16, 16), CPUMipPyramid::RGBA8);
+	CHECK(!odd.setLayout(CPUMipPyramid::MORTON));
+	CHECK(odd.layout == CPUMipPyramid::LINEAR);
+
+	TestRandom random(5);
+	for (CPUMipPyramid::Format format : { CPUMipPyramid::RGBA8, CPUMipPyramid::RGBA16F }) {
+		for (CPUMipBuilder::Filter filter : { CPUMipBuilder::BOX, CPUMipBuilder::OPACITY_WEIGHTED }) {
+			CPUMipPyramid linear = makePyramid(glm::ivec3(32), format);
+			fillRandom(linear, random);
+			CPUMipPyramid morton = linear, single = linear;
+
+			CPUMipBuilder(4).build(linear, 6, filter);
+			CPUMipBuilder(1).build(single, 6, filter);
+			CHECK(linear.levels == single.levels);
+
+			CHECK(morton.setLayout(CPUMipPyramid::MORTON));
+			// The children of a Morton texel follow it in summing order
+			CHECK(morton.index(0, glm::ivec3(1, 0, 0)) == 4 && morton.index(0, glm::ivec3(0, 0, 1)) == 1);
+			CPUMipBuilder(4).build(morton, 6, filter);
+			CHECK(morton.setLayout(CPUMipPyramid::LINEAR));
+			CHECK(linear.levels == morton.levels);
+		}
+	}
+}
+
+// SSE, F16C and plain C++ builds all hash to the same constant
+void testRandomChains() {
+	TestRandom random(3);
+	uint32_t hash = 2166136261u;
+	for (glm::ivec3 dims : { glm::ivec3(16), glm::ivec3(9, 5, 3) }) {
+		for (CPUMipPyramid::Format format : { CPUMipPyramid::RGBA8, CPUMipPyramid::RGBA16F }) {
+			for (CPUMipBuilder::Filter filter : { CPUMipBuilder::BOX, CPUMipBuilder::OPACITY_WEIGHTED }) {
+				CPUMipPyramid pyramid = makePyramid(dims, format);
+				fillRandom(pyramid, random);
+				CPUMipBuilder(2).build(pyramid, 16, filter);
+				for (const std::vector<unsigned char> &level : pyramid.levels) {
+					hash = testHash(level.data(), level.size(), hash);
+				}
+			}
+		}
+	}
+	CHECK(hash == RANDOM_CHAINS_HASH);
+}
+
+}
+
+void testMipPyramid() {
+	LOG_INFO("CPUMipBuilder, SSE2 ", CPUMipBuilder::usesSSE2(), ", F16C ", CPUMipBuilder::usesF16C());
+	testRGBA8Block();
+	testRGBA8Reference();
+	testRGBA16FBlocks();
+	testOpacityWeighted();
+	testMortonLayout();
+	testRandomChains();
+}
@@ -0,0 +1,16 @@
+#include "CPUTests.h"
+
+// Tests for the CPU library, run by ctest once for each library variant in src/CPU/CMakeLists.txt
+int testFailures = 0;
+
+int main() {
+	testVoxelizer();
+	testMipPyramid();
+
+	if (testFailures > 0) {
+		LOG_ERROR(testFailures, " checks failed");
+		return 1;
+	}
+	LOG_INFO("All checks passed");
+	return 0;
+}
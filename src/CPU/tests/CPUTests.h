@@ -0,0 +1,40 @@
+#ifndef CPUTESTS_H
+#define CPUTESTS_H
+
+#include <iostream>
+#include <cstdint>
+
+#include "log.h"
+
+// Failed CHECKs so far, main returns nonzero if any
+extern int testFailures;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			LOG_ERROR("CHECK failed: ", #condition); \
+			testFailures++; \
+		} \
+	} while (0)
+
+// Deterministic on every platform, unlike the distributions in <random>
+struct TestRandom {
+	uint32_t state;
+	explicit TestRandom(uint32_t seed) : state(seed) {}
+	uint32_t next() { state = state * 1664525u + 1013904223u; return state >> 8; }
+	float uniform(float lo, float hi) { return lo + (hi - lo) * (next() & 0xFFFF) / 65535.0f; }
+};
+
+// FNV-1a, for checking large results against constants
+inline uint32_t testHash(const void *data, size_t size, uint32_t hash = 2166136261u) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+void testVoxelizer();
+void testMipPyramid();
+
+#endif
@@ -0,0 +1,137 @@
+#include "CPUTests.h"
+
+#include "CPU/CPUVoxelizer.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Position, normal and texcoord
+const size_t STRIDE = 8;
+
+// Voxels testRandomTriangles covers and the hash of their indices
+const uint32_t RANDOM_COVERED = 5926;
+const uint32_t RANDOM_COVERAGE_HASH = 2858238100u;
+
+bool near(const glm::vec4 &a, const glm::vec4 &b) {
+	const float epsilon = 1e-6f;
+	return std::abs(a.x - b.x) < epsilon && std::abs(a.y - b.y) < epsilon && std::abs(a.z - b.z) < epsilon && std::abs(a.w - b.w) < epsilon;
+}
+
+// Two triangles on top of each other in the middle of layer z = 2 of an 8^3 grid of unit voxels. Clear of the voxel
+// faces by a quarter voxel, so voxel (x, y, 2) is covered exactly when 1 <= x, 1 <= y and x + y <= 6. The first is
+// white with +z normals, the second samples a red texture with +x normals.
+void testKnownTriangles() {
+	const float vertices[] = {
+		1.25f, 1.25f, 2.5f, 0, 0, 1, 0, 0,
+		5.5f, 1.25f, 2.5f, 0, 0, 1, 1, 0,
+		1.25f, 5.5f, 2.5f, 0, 0, 1, 0, 1,
+		1.25f, 1.25f, 2.5f, 1, 0, 0, 0, 0,
+		5.5f, 1.25f, 2.5f, 1, 0, 0, 1, 0,
+		1.25f, 5.5f, 2.5f, 1, 0, 0, 0, 1,
+	};
+	const uint32_t indices[] = { 0, 1, 2, 3, 4, 5 };
+	CPUImage red;
+	red.width = red.height = 1;
+	red.pixels = { 255, 0, 0, 255 };
+
+	std::vector<CPUTriangles> meshes(2);
+	for (int i = 0; i < 2; i++) {
+		meshes[i].vertices = vertices;
+		meshes[i].vertexStride = STRIDE;
+		meshes[i].indices = indices + 3 * i;
+		meshes[i].triangleCount = 1;
+	}
+	meshes[1].diffuse = &red;
+
+	for (int threads : { 1, 4 }) {
+		CPUVoxelizer voxelizer(threads);
+		CPUVoxelGrid grid;
+		voxelizer.voxelize(meshes, glm::ivec3(8), glm::vec3(0.0f), 1.0f, grid);
+		CHECK(grid.color.size() == 512 && grid.normal.size() == 512);
+
+		int covered = 0, wrong = 0;
+		for (int z = 0; z < 8; z++) {
+			for (int y = 0; y < 8; y++) {
+				for (int x = 0; x < 8; x++) {
+					size_t index = grid.index(glm::ivec3(x, y, z));
+					bool expected = z == 2 && x >= 1 && y >= 1 && x + y <= 6;
+					if (!expected) {
+						wrong += grid.color[index] != glm::vec4(0.0f) || grid.normal[index] != glm::vec4(0.0f);
+						continue;
+					}
+					covered++;
+					wrong += !near(grid.color[index], glm::vec4(1.0f, 0.5f, 0.5f, 1.0f));
+					wrong += !near(grid.normal[index], glm::vec4(0.5f, 0.0f, 0.5f, 1.0f));
+				}
+			}
+		}
+		CHECK(covered == 15);
+		CHECK(wrong == 0);
+	}
+}
+
+// Scattered triangles over a grid that is not a whole number of tiles, some hanging over its edges
+void testRandomTriangles() {
+	TestRandom random(7);
+	std::vector<float> vertices;
+	std::vector<uint32_t> indices;
+	const glm::vec3 gridMin(-2.0f, -1.0f, 0.5f);
+	const glm::ivec3 dims(40, 24, 33);
+	const float voxelSize = 0.5f;
+	for (uint32_t i = 0; i < 300; i++) {
+		glm::vec3 center(random.uniform(-3.0f, 19.0f), random.uniform(-2.0f, 12.0f), random.uniform(-0.5f, 17.5f));
+		float size = random.uniform(0.1f, 4.0f);
+		for (int v = 0; v < 3; v++) {
+			// Normals in the positive octant never cancel out when interpolated
+			float vertex[STRIDE] = {
+				center.x + random.uniform(-size, size), center.y + random.uniform(-size, size), center.z + random.uniform(-size, size),
+				random.uniform(0.1f, 1.0f), random.uniform(0.1f, 1.0f), random.uniform(0.1f, 1.0f),
+				random.uniform(0.0f, 1.0f), random.uniform(0.0f, 1.0f),
+			};
+			vertices.insert(vertices.end(), vertex, vertex + STRIDE);
+			indices.push_back(3 * i + v);
+		}
+	}
+	CPUImage texture;
+	texture.width = 5;
+	texture.height = 3;
+	for (int i = 0; i < 4 * 5 * 3; i++) {
+		texture.pixels.push_back((unsigned char)random.next());
+	}
+	std::vector<CPUTriangles> meshes(1);
+	meshes[0].vertices = vertices.data();
+	meshes[0].vertexStride = STRIDE;
+	meshes[0].indices = indices.data();
+	meshes[0].triangleCount = indices.size() / 3;
+	meshes[0].diffuse = &texture;
+
+	CPUVoxelGrid single, threaded;
+	CPUVoxelizer(1).voxelize(meshes, dims, gridMin, voxelSize, single);
+	CPUVoxelizer(5).voxelize(meshes, dims, gridMin, voxelSize, threaded);
+	CHECK(single.color.size() == threaded.color.size());
+	CHECK(std::memcmp(single.color.data(), threaded.color.data(), single.color.size() * sizeof(glm::vec4)) == 0);
+	CHECK(std::memcmp(single.normal.data(), threaded.normal.data(), single.normal.size() * sizeof(glm::vec4)) == 0);
+
+	// Coverage is exact on every path, AVX2 or not, so it is checked against constants
+	uint32_t hash = 2166136261u, covered = 0;
+	for (uint32_t i = 0; i < (uint32_t)single.color.size(); i++) {
+		if (single.color[i].w > 0.0f) {
+			unsigned char bytes[4] = { (unsigned char)i, (unsigned char)(i >> 8), (unsigned char)(i >> 16), (unsigned char)(i >> 24) };
+			hash = testHash(bytes, sizeof(bytes), hash);
+			covered++;
+		}
+	}
+	CHECK(covered == RANDOM_COVERED);
+	CHECK(hash == RANDOM_COVERAGE_HASH);
+}
+
+}
+
+void testVoxelizer() {
+	LOG_INFO("CPUVoxelizer, AVX2 ", CPUVoxelizer::usesAVX2());
+	testKnownTriangles();
+	testRandomTriangles();
+}
@@ -0,0 +1,97 @@
+#include "ComputeVoxelizer.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "common.h"
+
+// Same as voxelizeCompute.comp
+enum { STAGE_TRIANGLES, STAGE_BIN, STAGE_VOXELS };
+
+ComputeVoxelizer::~ComputeVoxelizer() {
+	if (isInitialized()) {
+		GLuint buffers[] = { largeTriangles, tilePairs };
+		glDeleteBuffers(2, buffers);
+	}
+}
+
+void ComputeVoxelizer::loadPrograms() {
+	program.attachAndLinkAsync({SHADER_DIR "voxelizeCompute.comp"});
+	program.setObjectLabel("Voxelize Compute");
+}
+
+std::vector<GLShaderProgram *> ComputeVoxelizer::getPrograms() {
+	return { &program };
+}
+
+void ComputeVoxelizer::init() {
+	// Grown when a rebuild overflows them
+	glCreateBuffers(1, &largeTriangles);
+	glCreateBuffers(1, &tilePairs);
+	allocate(1 << 16, 1 << 20);
+}
+
+void ComputeVoxelizer::allocate(GLuint largeCapacity, GLuint pairCapacity) {
+	this->largeCapacity = largeCapacity;
+	this->pairCapacity = pairCapacity;
+	// Indirect dispatch size and count, the pair list also the dropped count and padding to align the pairs
+	glNamedBufferData(largeTriangles, (4 + (GLsizeiptr)largeCapacity) * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+	glNamedBufferData(tilePairs, (6 + 2 * (GLsizeiptr)pairCapacity) * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+}
+
+void ComputeVoxelizer::voxelize(const Scene &scene, Scene::Filter filter, GLuint color, GLuint normal, GLenum voxelFormat,
+	const glm::vec3 &voxelMin, float voxelSize, bool sortedFragments) {
+	program.bind();
+	program.setUniform3fv("voxelMin", voxelMin);
+	program.setUniform1f("voxelSize", voxelSize);
+	program.setUniform1i("sortedFragments", sortedFragments);
+	glBindImageTexture(0, color, 0, GL_TRUE, 0, GL_READ_WRITE, voxelFormat);
+	glBindImageTexture(1, normal, 0, GL_TRUE, 0, GL_READ_WRITE, voxelFormat);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, largeTriangles);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, tilePairs);
+
+	const GLuint zero = 0;
+	glNamedBufferSubData(tilePairs, 4 * sizeof(GLuint), sizeof(zero), &zero);
+
+	// Both lists are emptied per drawable, a 0x1x1 dispatch
+	const GLuint listHeader[4] = { 0, 1, 1, 0 };
+	scene.dispatch(program.getHandle(), [&](GLuint triangles) {
+		glNamedBufferSubData(largeTriangles, 0, sizeof(listHeader), listHeader);
+		glNamedBufferSubData(tilePairs, 0, sizeof(listHeader), listHeader);
+
+		program.setUniform1ui("triangleCount", triangles);
+		program.setUniform1i("stage", STAGE_TRIANGLES);
+		glDispatchCompute(std::max(1u, std::min((triangles + 64 - 1) / 64, 65535u)), 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+		program.setUniform1i("stage", STAGE_BIN);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, largeTriangles);
+		glDispatchComputeIndirect(0);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+		program.setUniform1i("stage", STAGE_VOXELS);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, tilePairs);
+		glDispatchComputeIndirect(0);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	}, filter);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+	// Read back like the octree's fragment count, voxelization only runs when geometry changes
+	GLuint dropped = 0;
+	glGetNamedBufferSubData(tilePairs, 4 * sizeof(GLuint), sizeof(dropped), &dropped);
+	if (dropped > 0) {
+		LOG_WARN("Compute voxelizer dropped ", dropped, " large triangles or bricks, growing its lists for the next rebuild");
+		allocate(2 * largeCapacity, 2 * pairCapacity);
+	}
+
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+	glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_WRITE, voxelFormat);
+	glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_WRITE, voxelFormat);
+	program.unbind();
+}
+
+size_t ComputeVoxelizer::getAllocatedMemory() const {
+	return ((size_t)largeCapacity + 2 * (size_t)pairCapacity) * sizeof(GLuint);
+}
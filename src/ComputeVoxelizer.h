@@ -0,0 +1,50 @@
+#ifndef COMPUTEVOXELIZER_H
+#define COMPUTEVOXELIZER_H
+
+#include <Graphics/opengl.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "Graphics/GLShaderProgram.h"
+#include "Scene.h"
+
+// Software voxelizer for the dense grid, see voxelizeCompute.comp. Every voxel a triangle overlaps is written,
+// found by separating axis tests instead of rasterizing along the dominant axis, so thin and grazing triangles
+// are covered without conservative rasterization. Small triangles are tested by one invocation, large ones
+// are binned into 4^3 bricks first and each brick is tested by a workgroup.
+class ComputeVoxelizer {
+public:
+	ComputeVoxelizer() = default;
+	~ComputeVoxelizer();
+
+	ComputeVoxelizer(const ComputeVoxelizer &other) = delete;
+	ComputeVoxelizer &operator=(const ComputeVoxelizer &other) = delete;
+
+	// Submits the shader, before init so it compiles in the background
+	void loadPrograms();
+	std::vector<GLShaderProgram *> getPrograms();
+
+	void init();
+	bool isInitialized() const { return largeTriangles != 0; }
+
+	// Adds the filtered nodes to color and normal, bound with voxelFormat, like voxelize.frag. The grid starts
+	// at voxelMin with voxelSize wide voxels. With sortedFragments the fragments go to the fragment list bound
+	// by VoxelFragmentSort::beginFragments instead.
+	void voxelize(const Scene &scene, Scene::Filter filter, GLuint color, GLuint normal, GLenum voxelFormat,
+		const glm::vec3 &voxelMin, float voxelSize, bool sortedFragments);
+
+	size_t getAllocatedMemory() const;
+
+private:
+	GLShaderProgram program;
+
+	GLuint largeTriangles = 0, tilePairs = 0;
+	GLuint largeCapacity = 0, pairCapacity = 0;
+
+	void allocate(GLuint largeCapacity, GLuint pairCapacity);
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "FileWatcher.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#else
+#include <sys/stat.h>
+#include <GLFW/glfw3.h>
+#endif
+
+#include "common.h"
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher() {
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		LOG_WARN("inotify_init1 failed, file watching disabled");
+	}
+}
+
+FileWatcher::~FileWatcher() {
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+void FileWatcher::watch(const std::string &file) {
+	if (fd < 0 || !files.insert(file).second) return;
+
+	// Watch the directory rather than the file, editors often save by writing a new file and renaming it
+	std::string directory = file.substr(0, file.find_last_of('/') + 1);
+	for (const auto &d : directories) {
+		if (d.second == directory) return;
+	}
+
+	int wd = inotify_add_watch(fd, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd < 0) {
+		LOG_WARN("Failed to watch ", directory);
+		return;
+	}
+	directories[wd] = directory;
+}
+
+std::vector<std::string> FileWatcher::poll() {
+	std::set<std::string> changed;
+	if (fd < 0) return {};
+
+	alignas(struct inotify_event) char buffer[4096];
+	while (true) {
+		ssize_t length = read(fd, buffer, sizeof(buffer));
+		if (length <= 0) break;
+
+		for (char *ptr = buffer; ptr < buffer + length;) {
+			const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+			if (event->len > 0 && directories.count(event->wd)) {
+				std::string file = directories[event->wd] + event->name;
+				if (files.count(file)) {
+					changed.insert(file);
+				}
+			}
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	return std::vector<std::string>(changed.begin(), changed.end());
+}
+
+#else
+
+static long long modifiedTime(const std::string &file) {
+	struct stat info;
+	if (stat(file.c_str(), &info) != 0) return 0;
+	return (long long)info.st_mtime;
+}
+
+FileWatcher::FileWatcher() {}
+FileWatcher::~FileWatcher() {}
+
+void FileWatcher::watch(const std::string &file) {
+	if (!files.insert(file).second) return;
+	modifiedTimes[file] = modifiedTime(file);
+}
+
+std::vector<std::string> FileWatcher::poll() {
+	std::vector<std::string> changed;
+
+	// stat is not free, only check twice a second
+	double now = glfwGetTime();
+	if (now - lastPoll < 0.5) return changed;
+	lastPoll = now;
+
+	for (auto &entry : modifiedTimes) {
+		long long time = modifiedTime(entry.first);
+		if (time != entry.second) {
+			entry.second = time;
+			changed.push_back(entry.first);
+		}
+	}
+
+	return changed;
+}
+
+#endif
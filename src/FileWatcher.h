@@ -0,0 +1,37 @@
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+// Reports files that were written since the last poll. Uses inotify on Linux and
+// falls back to comparing modification times elsewhere.
+class FileWatcher {
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher &other) = delete;
+	FileWatcher &operator=(const FileWatcher &other) = delete;
+	FileWatcher(FileWatcher &&other) = delete;
+	FileWatcher &operator=(FileWatcher &&other) = delete;
+
+	void watch(const std::string &file);
+	// Non-blocking, returns each changed file once
+	std::vector<std::string> poll();
+
+private:
+	std::set<std::string> files;
+
+#ifdef __linux__
+	int fd = -1;
+	std::map<int, std::string> directories;
+#else
+	std::map<std::string, long long> modifiedTimes;
+	double lastPoll = 0.0;
+#endif
+};
+
+#endif
@@ -34,6 +34,35 @@ void GLFramebuffer::attachTexture(GLenum attachment, GLint internalFormat, GLsiz
 
 	glFramebufferTexture2D(this->currentTarget, attachment, GL_TEXTURE_2D, texture, 0);
 	this->textures.push_back(texture);
+	this->textureTargets.push_back(GL_TEXTURE_2D);
+}
+
+void GLFramebuffer::attachTextureArray(GLenum attachment, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei layers, GLint minFilter, GLint magFilter, GLint wrapS, GLint wrapT, const glm::vec4 *borderColor) {
+	GLuint texture;
+	glGenTextures(1, &texture);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, internalFormat, width, height, layers);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, minFilter);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, magFilter);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrapS);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrapT);
+
+	if (borderColor != nullptr) {
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, glm::value_ptr(*borderColor));
+	}
+
+	glFramebufferTextureLayer(this->currentTarget, attachment, texture, 0, 0);
+	this->textures.push_back(texture);
+	this->textureTargets.push_back(GL_TEXTURE_2D_ARRAY);
+}
+
+void GLFramebuffer::attachLayer(GLenum attachment, std::vector<GLuint>::size_type index, GLint layer) {
+	assert(index < this->textures.size());
+
+	glFramebufferTextureLayer(this->currentTarget, attachment, this->textures[index], 0, layer);
 }
 
 void GLFramebuffer::attachRenderbuffer(GLenum attachment, GLenum internalFormat, GLsizei width, GLsizei height) {
@@ -47,6 +76,14 @@ void GLFramebuffer::attachRenderbuffer(GLenum attachment, GLenum internalFormat,
 	this->renderbuffers.push_back(rbo);
 }
 
+void GLFramebuffer::deleteAttachments() {
+	glDeleteTextures((GLsizei)textures.size(), textures.data());
+	glDeleteRenderbuffers((GLsizei)renderbuffers.size(), renderbuffers.data());
+	this->textures.clear();
+	this->textureTargets.clear();
+	this->renderbuffers.clear();
+}
+
 void GLFramebuffer::bind(GLenum target) {
 	this->currentTarget = target;
 	glBindFramebuffer(target, this->handle);
@@ -54,9 +91,9 @@ void GLFramebuffer::bind(GLenum target) {
 
 void GLFramebuffer::bindTextures() {
 	GLuint active = GL_TEXTURE0;
-	for (auto texture : textures) {
+	for (size_t i = 0; i < textures.size(); i++) {
 		glActiveTexture(active++);
-		glBindTexture(GL_TEXTURE_2D, texture);
+		glBindTexture(textureTargets[i], textures[i]);
 	}
 }
 
@@ -66,9 +103,9 @@ void GLFramebuffer::unbind() {
 
 void GLFramebuffer::unbindTextures() {
 	GLuint active = GL_TEXTURE0;
-	for (auto texture : textures) {
+	for (size_t i = 0; i < textures.size(); i++) {
 		glActiveTexture(active++);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindTexture(textureTargets[i], 0);
 	}
 	glActiveTexture(GL_TEXTURE0);
 }
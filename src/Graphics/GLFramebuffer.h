@@ -18,7 +18,12 @@ public:
 	GLFramebuffer &operator=(GLFramebuffer &&other) = delete;
 
 	void attachTexture(GLenum attachment, GLint internalFormat, GLsizei width, GLsizei height, GLenum format, GLenum type, GLint minFilter = GL_NEAREST, GLint magFilter = GL_NEAREST, GLint wrapS = GL_REPEAT, GLint wrapT = GL_REPEAT, const glm::vec4 *borderColor = nullptr);
+	// Immutable 2D array texture, attaches layer 0, use attachLayer to render to the others
+	void attachTextureArray(GLenum attachment, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei layers, GLint minFilter = GL_NEAREST, GLint magFilter = GL_NEAREST, GLint wrapS = GL_REPEAT, GLint wrapT = GL_REPEAT, const glm::vec4 *borderColor = nullptr);
+	void attachLayer(GLenum attachment, std::vector<GLuint>::size_type index, GLint layer);
 	void attachRenderbuffer(GLenum attachment, GLenum internalFormat, GLsizei width, GLsizei height);
+	// Deletes every attached texture and renderbuffer so they can be attached again at another size
+	void deleteAttachments();
 
 	void bind(GLenum target = GL_FRAMEBUFFER);
 	void bindTextures();
@@ -33,6 +38,7 @@ private:
 	GLuint handle;
 	GLenum currentTarget;
 	std::vector<GLuint> textures;
+	std::vector<GLenum> textureTargets;
 	std::vector<GLuint> renderbuffers;
 };
 
@@ -9,6 +9,7 @@
 #include <sstream>
 #include <fstream>
 #include <unordered_map>
+#include <algorithm>
 #include <common.h>
 
 static void APIENTRY glDebugOutput(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *userParam);
@@ -231,9 +232,73 @@ std::string GLHelper::readText(const std::string &filename) {
     return buffer.str();
 }
 
+std::string GLHelper::shaderDefines;
+
+// Source inserted after the #version line of every shader read from now on, programs compiled before keep theirs
+void GLHelper::setShaderDefines(const std::string &defines) {
+    shaderDefines = defines;
+}
+
+static void expandIncludes(const std::string &filename, std::vector<std::string> &included, std::ostream &out) {
+    if (std::find(included.begin(), included.end(), filename) != included.end()) {
+        return;
+    }
+    included.push_back(filename);
+
+    std::ifstream ifs {filename};
+    if (!ifs) {
+        LOG_ERROR("SHADER::INCLUDE_NOT_FOUND::", filename);
+        return;
+    }
+
+    // #version has to stay the first line of the top level file
+    if (included.size() > 1) {
+        out << "#line 1\n";
+    }
+
+    std::string basedir = filename.substr(0, filename.find_last_of('/') + 1);
+    std::string line;
+    int lineNumber = 1;
+    while (std::getline(ifs, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+            size_t open = line.find('"', start), close = line.rfind('"');
+            if (open != std::string::npos && close > open) {
+                expandIncludes(basedir + line.substr(open + 1, close - open - 1), included, out);
+                out << "#line " << lineNumber + 1 << "\n";
+                lineNumber++;
+                continue;
+            }
+        }
+        out << line << "\n";
+        if (included.front() == filename && start != std::string::npos && line.compare(start, 8, "#version") == 0 && !GLHelper::shaderDefines.empty()) {
+            out << GLHelper::shaderDefines << "#line " << lineNumber + 1 << "\n";
+        }
+        lineNumber++;
+    }
+}
+
+// Reads a shader, expanding #include "file" directives (relative to the including file, each file included once).
+// Every file that was read is appended to dependencies.
+std::string GLHelper::readShaderSource(const std::string &filename, std::vector<std::string> *dependencies) {
+    std::vector<std::string> included;
+    std::stringstream buffer;
+    expandIncludes(filename, included, buffer);
+
+    if (dependencies != nullptr) {
+        for (const auto &file : included) {
+            if (std::find(dependencies->begin(), dependencies->end(), file) == dependencies->end()) {
+                dependencies->push_back(file);
+            }
+        }
+    }
+
+    return buffer.str();
+}
+
 // Create a shader from a single file.
-GLuint GLHelper::createShaderFromFile(GLenum shaderType, const std::string &filename) {
-    std::string str = GLHelper::readText(filename);
+GLuint GLHelper::createShaderFromFile(GLenum shaderType, const std::string &filename, std::vector<std::string> *dependencies) {
+    std::string str = GLHelper::readShaderSource(filename, dependencies);
     const char *shaderString = str.c_str();
 
 	GLuint shader = GLHelper::createShaderFromString(shaderType, shaderString);
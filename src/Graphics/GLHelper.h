@@ -19,13 +19,18 @@ public:
     static GLuint createTextureFromImage(const std::string &imagename);
     static GLuint createCubemap(const std::vector<std::string> &imagenames);
     static std::string readText(const std::string &filename);
-    static GLuint createShaderFromFile(GLenum shaderType, const std::string &filename);
+    static std::string readShaderSource(const std::string &filename, std::vector<std::string> *dependencies = nullptr);
+    // #define lines for every shader read afterwards, one per line
+    static void setShaderDefines(const std::string &defines);
+    static GLuint createShaderFromFile(GLenum shaderType, const std::string &filename, std::vector<std::string> *dependencies = nullptr);
     static GLuint createShaderFromString(GLenum shaderType, const char *shaderText);
     static bool checkShaderStatus(GLuint shader);
     static bool checkShaderProgramStatus(GLuint program);
     static bool checkFramebufferComplete(GLuint fbo);
     
     static GLenum shaderTypeFromExtension(const std::string &filename);
+
+    static std::string shaderDefines;
 };
 
 #endif
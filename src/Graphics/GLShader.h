@@ -3,15 +3,16 @@
 
 #include <cassert>
 #include <string>
+#include <vector>
 
 #include "opengl.h"
 #include "GLHelper.h"
 
 class GLShader {
 public:
-    GLShader(GLenum shaderType, const std::string &shaderSource, bool fromFile = true) {
+    GLShader(GLenum shaderType, const std::string &shaderSource, bool fromFile = true, std::vector<std::string> *dependencies = nullptr) {
         if (fromFile) {
-            this->handle = GLHelper::createShaderFromFile(shaderType, shaderSource);
+            this->handle = GLHelper::createShaderFromFile(shaderType, shaderSource, dependencies);
         }
         else {
             this->handle = GLHelper::createShaderFromString(shaderType, shaderSource.c_str());
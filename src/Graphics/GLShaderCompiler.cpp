@@ -0,0 +1,116 @@
+#include <Graphics/opengl.h>
+#include <GLFW/glfw3.h>
+#include "GLShaderCompiler.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <common.h>
+
+struct GLShaderCompiler::Worker {
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<std::packaged_task<void()>> jobs;
+	bool stop = false;
+};
+
+bool GLShaderCompiler::parallelCompile = false;
+GLFWwindow *GLShaderCompiler::workerContext = nullptr;
+GLShaderCompiler::Worker *GLShaderCompiler::worker = nullptr;
+
+void GLShaderCompiler::init(GLFWwindow *window) {
+	if (parallelCompile || worker) return;
+
+	if (GLAD_GL_KHR_parallel_shader_compile) {
+		// 0xFFFFFFFF lets the driver pick the number of threads
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		parallelCompile = true;
+		LOG_INFO("Compiling shaders with GL_KHR_parallel_shader_compile");
+		return;
+	}
+	if (GLAD_GL_ARB_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		parallelCompile = true;
+		LOG_INFO("Compiling shaders with GL_ARB_parallel_shader_compile");
+		return;
+	}
+
+	// Hidden 1x1 window whose context shares objects with the main window. Context version hints
+	// set when the main window was created are still active.
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	workerContext = glfwCreateWindow(1, 1, "", nullptr, window);
+	glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+	if (workerContext == nullptr) {
+		LOG_WARN("Failed to create shared context, shaders will be compiled on the main thread");
+		return;
+	}
+
+	worker = new Worker();
+	worker->thread = std::thread([]() {
+		glfwMakeContextCurrent(workerContext);
+
+		while (true) {
+			std::packaged_task<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(worker->mutex);
+				worker->cv.wait(lock, []() { return worker->stop || !worker->jobs.empty(); });
+				if (worker->jobs.empty()) break;
+				job = std::move(worker->jobs.front());
+				worker->jobs.pop_front();
+			}
+			job();
+		}
+
+		glfwMakeContextCurrent(nullptr);
+	});
+	LOG_INFO("Compiling shaders on a shared context worker thread");
+}
+
+void GLShaderCompiler::shutdown() {
+	if (worker) {
+		{
+			std::lock_guard<std::mutex> lock(worker->mutex);
+			worker->stop = true;
+		}
+		worker->cv.notify_one();
+		worker->thread.join();
+
+		delete worker;
+		worker = nullptr;
+	}
+
+	if (workerContext) {
+		glfwDestroyWindow(workerContext);
+		workerContext = nullptr;
+	}
+
+	parallelCompile = false;
+}
+
+std::future<void> GLShaderCompiler::enqueue(std::function<void()> job) {
+	// glFinish so the objects are complete before the main context looks at them
+	std::packaged_task<void()> task([job]() {
+		job();
+		glFinish();
+	});
+	std::future<void> future = task.get_future();
+
+	if (!worker) {
+		task();
+		return future;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(worker->mutex);
+		worker->jobs.push_back(std::move(task));
+	}
+	worker->cv.notify_one();
+
+	return future;
+}
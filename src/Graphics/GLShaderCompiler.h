@@ -0,0 +1,32 @@
+#ifndef GLSHADERCOMPILER_H
+#define GLSHADERCOMPILER_H
+
+#include <Graphics/opengl.h>
+
+#include <functional>
+#include <future>
+
+struct GLFWwindow;
+
+// Background shader compilation. Uses KHR/ARB_parallel_shader_compile when the driver supports it,
+// otherwise compiles on a worker thread that owns a hidden context shared with the main window.
+class GLShaderCompiler {
+public:
+	static void init(GLFWwindow *window);
+	static void shutdown();
+
+	static bool hasParallelCompile() { return parallelCompile; }
+	static bool hasWorker() { return worker != nullptr; }
+
+	// Runs job on the worker thread's context, the future is ready once the job's commands have completed
+	static std::future<void> enqueue(std::function<void()> job);
+
+private:
+	struct Worker;
+
+	static bool parallelCompile;
+	static GLFWwindow *workerContext;
+	static Worker *worker;
+};
+
+#endif
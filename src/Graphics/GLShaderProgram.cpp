@@ -5,7 +5,10 @@
 #include "GLShaderProgram.h"
 #include "GLShader.h"
 #include "GLHelper.h"
+#include "GLShaderCompiler.h"
 #include <common.h>
+#include <algorithm>
+#include <chrono>
 
 GLShaderProgram::GLShaderProgram() {
 	handle = glCreateProgram();
@@ -16,6 +19,12 @@ GLShaderProgram::GLShaderProgram(std::initializer_list<const std::string> shader
 }
 
 GLShaderProgram::~GLShaderProgram() {
+	if (pendingJob.valid()) {
+		pendingJob.wait();
+	}
+	for (const auto &shader : pendingShaders) {
+		glDeleteShader(shader.handle);
+	}
     glDeleteProgram(handle);
 }
 
@@ -24,15 +33,21 @@ GLShaderProgram &GLShaderProgram::attachShader(const std::string &shaderFile) {
 }
 
 GLShaderProgram &GLShaderProgram::attachShader(GLenum shaderType, const std::string &shaderFile) {
-	GLShader shader { shaderType, shaderFile };
+	GLShader shader { shaderType, shaderFile, true, &dependencies };
 	glAttachShader(handle, shader.getHandle());
+	files.push_back(shaderFile);
 
 	return *this;
 }
 
 void GLShaderProgram::linkProgram() {
 	glLinkProgram(handle);
+	cacheUniforms();
+}
+
+void GLShaderProgram::cacheUniforms() const {
 	linkStatus = GLHelper::checkShaderProgramStatus(handle);
+	uniforms.clear();
 
 	if (linkStatus) {
 		GLint uniformCount, uniformMaxLength;
@@ -47,6 +62,12 @@ void GLShaderProgram::linkProgram() {
 			glGetActiveUniform(handle, i, uniformMaxLength, &length, &size, &type, name.data()); 
 			location = glGetUniformLocation(handle, name.data());
 			uniforms[name.data()] = location;
+
+			// Arrays are reported as name[0], also allow setting them by their plain name
+			std::string uniformName = name.data();
+			if (size > 1 && uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0) {
+				uniforms[uniformName.substr(0, uniformName.size() - 3)] = location;
+			}
 		}
 	}
 }
@@ -58,11 +79,158 @@ void GLShaderProgram::attachAndLink(std::initializer_list<const std::string> sha
 	linkProgram();
 }
 
+void GLShaderProgram::attachAndLinkAsync(std::initializer_list<const std::string> shaderFiles) {
+	std::vector<std::string> files(shaderFiles.begin(), shaderFiles.end());
+
+	if (GLShaderCompiler::hasParallelCompile()) {
+		compileAndLink(files);
+	}
+	else if (GLShaderCompiler::hasWorker()) {
+		pendingJob = GLShaderCompiler::enqueue([this, files]() { compileAndLink(files); });
+	}
+	else {
+		attachAndLink(shaderFiles);
+		return;
+	}
+
+	pending = true;
+}
+
+// Issues compile and link commands without querying any status, queries would block until the driver is done.
+void GLShaderProgram::compileAndLink(const std::vector<std::string> &shaderFiles) {
+	for (const auto &file : shaderFiles) {
+		std::string source = GLHelper::readShaderSource(file, &dependencies);
+		const char *sourceString = source.c_str();
+
+		GLuint shader = glCreateShader(GLHelper::shaderTypeFromExtension(file));
+		glShaderSource(shader, 1, &sourceString, NULL);
+		glCompileShader(shader);
+		glObjectLabel(GL_SHADER, shader, file.size(), file.c_str());
+		glAttachShader(handle, shader);
+
+		pendingShaders.push_back({shader, file});
+		files.push_back(file);
+	}
+	glLinkProgram(handle);
+}
+
+bool GLShaderProgram::poll() {
+	if (!pending) return true;
+
+	if (pendingJob.valid()) {
+		if (pendingJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			return false;
+		}
+	}
+	else {
+		GLint done = GL_TRUE;
+		glGetProgramiv(handle, GL_COMPLETION_STATUS_KHR, &done);
+		if (!done) {
+			return false;
+		}
+	}
+
+	join();
+	return true;
+}
+
+// Waits for an async link and reports its errors
+void GLShaderProgram::join() const {
+	if (!pending) return;
+	pending = false;
+
+	if (pendingJob.valid()) {
+		pendingJob.get();
+	}
+
+	for (const auto &shader : pendingShaders) {
+		if (!GLHelper::checkShaderStatus(shader.handle)) {
+			std::cerr << "\tin shader " << shader.file << std::endl;
+		}
+		glDetachShader(handle, shader.handle);
+		glDeleteShader(shader.handle);
+	}
+	pendingShaders.clear();
+
+	cacheUniforms();
+}
+
+bool GLShaderProgram::reload() {
+	join();
+
+	std::vector<std::string> newDependencies;
+	std::vector<GLuint> shaders;
+	bool success = true;
+	for (const auto &file : files) {
+		GLuint shader = GLHelper::createShaderFromFile(GLHelper::shaderTypeFromExtension(file), file, &newDependencies);
+		if (shader == 0) {
+			success = false;
+			continue;
+		}
+		glObjectLabel(GL_SHADER, shader, file.size(), file.c_str());
+		shaders.push_back(shader);
+	}
+
+	// Link into a scratch program first, a failed link would leave the real program without an executable
+	if (success) {
+		GLuint scratch = glCreateProgram();
+		for (GLuint shader : shaders) {
+			glAttachShader(scratch, shader);
+		}
+		glLinkProgram(scratch);
+		success = GLHelper::checkShaderProgramStatus(scratch);
+		glDeleteProgram(scratch);
+	}
+
+	if (!success) {
+		for (GLuint shader : shaders) {
+			glDeleteShader(shader);
+		}
+		LOG_WARN("Failed to reload program ", label, ", keeping the previous version");
+		return false;
+	}
+
+	GLint attachedCount = 0;
+	glGetProgramiv(handle, GL_ATTACHED_SHADERS, &attachedCount);
+	std::vector<GLuint> attached(attachedCount);
+	if (attachedCount > 0) {
+		glGetAttachedShaders(handle, attachedCount, nullptr, attached.data());
+	}
+	for (GLuint shader : attached) {
+		glDetachShader(handle, shader);
+	}
+
+	// Shaders are only flagged for deletion while attached
+	for (GLuint shader : shaders) {
+		glAttachShader(handle, shader);
+		glDeleteShader(shader);
+	}
+	linkProgram();
+
+	// Includes may have changed
+	dependencies = newDependencies;
+
+	LOG_INFO("Reloaded program ", label);
+	return linkStatus;
+}
+
+const std::vector<std::string> &GLShaderProgram::getDependencies() const {
+	join();
+	return dependencies;
+}
+
+bool GLShaderProgram::dependsOn(const std::string &file) const {
+	const auto &deps = getDependencies();
+	return std::find(deps.begin(), deps.end(), file) != deps.end();
+}
+
 GLuint GLShaderProgram::getHandle() const {
+	join();
     return handle;
 }
 
 void GLShaderProgram::bind() const {
+	join();
     glUseProgram(handle);
 }
 
@@ -71,10 +239,12 @@ void GLShaderProgram::unbind() const {
 }
 
 void GLShaderProgram::setObjectLabel(const std::string &label) {
+	this->label = label;
 	glObjectLabel(GL_PROGRAM, handle, label.size(), label.c_str());
 }
 
 GLint GLShaderProgram::uniformLocation(const GLchar *name) const {
+	join();
 	if (uniforms.count(name) == 0) {
 		// This should only happen for non-active uniforms (e.g. optimized out)
 		return -1;
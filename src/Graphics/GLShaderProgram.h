@@ -7,6 +7,8 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <initializer_list>
 #include <unordered_map>
+#include <vector>
+#include <future>
 
 class GLShaderProgram {
 public:
@@ -24,8 +26,18 @@ public:
     GLShaderProgram &attachShader(GLenum shaderType, const std::string &shaderFile);
     void linkProgram();
     void attachAndLink(std::initializer_list<const std::string> shaderFiles);
+    // Submits shaders for compilation without waiting on the driver, the result is joined the first time the program is used
+    void attachAndLinkAsync(std::initializer_list<const std::string> shaderFiles);
+    // Returns true once an async link has finished, without blocking
+    bool poll();
+    // Recompiles and relinks the same handle from the original files. Keeps the current program if that fails.
+    bool reload();
     GLuint getHandle() const;
 
+    // Shader files and everything they #include
+    const std::vector<std::string> &getDependencies() const;
+    bool dependsOn(const std::string &file) const;
+
     void bind() const;
     void unbind() const;
 
@@ -34,16 +46,37 @@ public:
     void setUniform1f(const GLchar *name, GLfloat v) { glUniform1f(uniformLocation(name), v); }
     void setUniform2f(const GLchar *name, GLfloat x, GLfloat y) { glUniform2f(uniformLocation(name), x, y); }
     void setUniform1i(const GLchar *name, GLint v) { glUniform1i(uniformLocation(name), v); }
+    void setUniform3i(const GLchar *name, GLint x, GLint y, GLint z) { glUniform3i(uniformLocation(name), x, y, z); }
     void setUniform1ui(const GLchar *name, GLuint v) { glUniform1ui(uniformLocation(name), v); }
     void setUniform3fv(const GLchar *name, const glm::vec3 &v) { glUniform3fv(uniformLocation(name), 1, glm::value_ptr(v)); }
     void setUniformMatrix4fv(const GLchar *name, const glm::mat4 &v) { glUniformMatrix4fv(uniformLocation(name), 1, GL_FALSE, glm::value_ptr(v)); }
+    void setUniform1fv(const GLchar *name, const GLfloat *v, GLsizei count) { glUniform1fv(uniformLocation(name), count, v); }
+    void setUniform1iv(const GLchar *name, const GLint *v, GLsizei count) { glUniform1iv(uniformLocation(name), count, v); }
+    void setUniform3iv(const GLchar *name, const glm::ivec3 *v, GLsizei count) { glUniform3iv(uniformLocation(name), count, glm::value_ptr(v[0])); }
+    void setUniformMatrix4fv(const GLchar *name, const glm::mat4 *v, GLsizei count) { glUniformMatrix4fv(uniformLocation(name), count, GL_FALSE, glm::value_ptr(v[0])); }
 
     void setObjectLabel(const std::string &label);
 
 private:
+    struct PendingShader {
+        GLuint handle;
+        std::string file;
+    };
+
     GLuint handle;
-    std::unordered_map<std::string, GLint> uniforms;
-    bool linkStatus = false;
+    std::string label;
+    std::vector<std::string> files;
+    std::vector<std::string> dependencies;
+    mutable std::unordered_map<std::string, GLint> uniforms;
+    mutable bool linkStatus = false;
+
+    mutable bool pending = false;
+    mutable std::vector<PendingShader> pendingShaders;
+    mutable std::future<void> pendingJob;
+
+    void compileAndLink(const std::vector<std::string> &shaderFiles);
+    void cacheUniforms() const;
+    void join() const;
 };
 
 #endif
\ No newline at end of file
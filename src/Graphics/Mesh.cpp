@@ -40,7 +40,7 @@ Mesh::Mesh(const std::string &meshname) {
 // modified from https://github.com/syoyo/tinyobjloader/blob/master/examples/viewer/viewer.cc
 void Mesh::loadMesh(const std::string &meshname) {
     string err;
-    string basedir = meshname.substr(0, meshname.find_last_of('/') + 1);
+    basedir = meshname.substr(0, meshname.find_last_of('/') + 1);
     bool status = LoadObj(&attrib, &shapes, &materials, &err, meshname.c_str(), basedir.c_str());
 
     if (!err.empty()) {
@@ -238,18 +238,27 @@ void Mesh::loadMesh(const std::string &meshname) {
         radius = glm::max(glm::max(extents.x, extents.y), extents.z) / 2.0f;
 
         for (Drawable &d : drawables) {
+            d.min = glm::vec3(numeric_limits<float>::max());
+            d.max = glm::vec3(-numeric_limits<float>::max());
+            for (GLuint index : d.indices) {
+                d.min = glm::min(d.min, vertices[index].position);
+                d.max = glm::max(d.max, vertices[index].position);
+            }
+
+            d.axisStart[0] = d.axisStart[1] = d.axisStart[2] = 0;
+            d.axisStart[3] = d.indices.size();
+
             glGenBuffers(1, &d.ebo);
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, d.ebo);
             glBufferData(GL_ELEMENT_ARRAY_BUFFER, d.indices.size() * sizeof(GLuint), d.indices.data(), GL_STATIC_DRAW);
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
         }
 
-        GLuint buf = 0;
         glGenVertexArrays(1, &vao);
-        glGenBuffers(1, &buf);
+        glGenBuffers(1, &vbo);
 
         glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, buf);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
 
@@ -283,7 +292,48 @@ void Mesh::loadMesh(const std::string &meshname) {
     }
 }
 
-void Mesh::draw(GLuint program) const {
+// True when all corners of the box are outside the same clip plane
+static bool outsideClipVolume(const glm::mat4 &m, const glm::vec3 &min, const glm::vec3 &max) {
+    int outside[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < 8; i++) {
+        glm::vec4 corner = m * glm::vec4(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z, 1.0f);
+        outside[0] += corner.x < -corner.w;
+        outside[1] += corner.x > corner.w;
+        outside[2] += corner.y < -corner.w;
+        outside[3] += corner.y > corner.w;
+        outside[4] += corner.z < -corner.w;
+        outside[5] += corner.z > corner.w;
+    }
+
+    for (int plane = 0; plane < 6; plane++) {
+        if (outside[plane] == 8) return true;
+    }
+    return false;
+}
+
+void Mesh::binAxes(const glm::mat4 &model) {
+    glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(model)));
+    for (Drawable &d : drawables) {
+        std::vector<GLuint> bins[3];
+        for (size_t i = 0; i + 2 < d.indices.size(); i += 3) {
+            const GLuint *tri = &d.indices[i];
+            glm::vec3 n = glm::abs(normalMatrix * (vertices[tri[0]].normal + vertices[tri[1]].normal + vertices[tri[2]].normal));
+            // Same ties as voxelize.geom
+            int axis = n.x > n.y && n.x > n.z ? 0 : n.y > n.x && n.y > n.z ? 1 : 2;
+            bins[axis].insert(bins[axis].end(), tri, tri + 3);
+        }
+
+        d.indices.clear();
+        for (int axis = 0; axis < 3; axis++) {
+            d.axisStart[axis] = d.indices.size();
+            d.indices.insert(d.indices.end(), bins[axis].begin(), bins[axis].end());
+        }
+        d.axisStart[3] = d.indices.size();
+        glNamedBufferSubData(d.ebo, 0, d.indices.size() * sizeof(GLuint), d.indices.data());
+    }
+}
+
+void Mesh::draw(GLuint program, const glm::mat4 *cull, int axis) const {
     GLint enableNormalMapLocation = glGetUniformLocation(program, "enableNormalMap");
     GLint enableNormalMap = 0;
     if  (enableNormalMapLocation >= 0)
@@ -291,6 +341,9 @@ void Mesh::draw(GLuint program) const {
 
     glBindVertexArray(vao);
     for (const auto &d : drawables) {
+        size_t first = axis < 0 ? 0 : d.axisStart[axis], last = axis < 0 ? d.indices.size() : d.axisStart[axis + 1];
+        if (first == last || (cull && outsideClipVolume(*cull, d.min, d.max))) continue;
+
         const auto &m = materials[d.material_id];
 
         GLuint default_texture = textures.at(DEFAULT_TEXTURE);
@@ -322,7 +375,7 @@ void Mesh::draw(GLuint program) const {
         glUniform1i(glGetUniformLocation(program, "material.hasNormalMap"), hasNormalMap);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, d.ebo);
-        glDrawElements(GL_TRIANGLES, d.indices.size(), GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, (GLsizei)(last - first), GL_UNSIGNED_INT, (const GLvoid *)(first * sizeof(GLuint)));
     }
 
     if  (enableNormalMapLocation >= 0)
@@ -333,3 +386,63 @@ void Mesh::draw(GLuint program) const {
     glBindVertexArray(0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
+
+void Mesh::dispatch(const std::function<void(GLuint triangles)> &dispatch) const {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, vbo);
+    for (const auto &d : drawables) {
+        if (d.indices.empty()) continue;
+
+        const auto &m = materials[d.material_id];
+        bool hasDiffuseMap = textures.count(m.diffuse_texname) != 0;
+        glBindTextureUnit(0, hasDiffuseMap ? textures.at(m.diffuse_texname) : textures.at(DEFAULT_TEXTURE));
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, d.ebo);
+        dispatch((GLuint)(d.indices.size() / 3));
+    }
+
+    glBindTextureUnit(0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
+}
+
+void Mesh::getTriangles(const glm::mat4 &model, std::vector<CPUTriangles> &triangles, std::map<std::string, CPUImage> &images) const {
+    for (const auto &d : drawables) {
+        if (d.indices.empty()) continue;
+
+        // Same texture Mesh::dispatch binds, the default one without a diffuse map
+        const auto &m = materials[d.material_id];
+        string file = m.diffuse_texname;
+        if (textures.count(file) == 0 || file == DEFAULT_TEXTURE) {
+            file = string(RESOURCE_DIR) + DEFAULT_TEXTURE;
+        }
+        else {
+            convertPathFromWindows(file);
+            file = basedir + file;
+        }
+
+        auto image = images.find(file);
+        if (image == images.end()) {
+            image = images.insert(make_pair(file, CPUImage())).first;
+            int width, height, channels;
+            unsigned char *pixels = stbi_load(file.c_str(), &width, &height, &channels, 4);
+            if (pixels == nullptr) {
+                LOG_ERROR("TEXTURE::LOAD_FAILED::", file);
+            }
+            else {
+                image->second.width = width;
+                image->second.height = height;
+                image->second.pixels.assign(pixels, pixels + 4 * (size_t)width * height);
+                stbi_image_free(pixels);
+            }
+        }
+
+        CPUTriangles t;
+        t.vertices = &vertices[0].position.x;
+        t.vertexStride = sizeof(Vertex) / sizeof(float);
+        t.indices = d.indices.data();
+        t.triangleCount = d.indices.size() / 3;
+        t.model = model;
+        t.diffuse = &image->second;
+        triangles.push_back(t);
+    }
+}
@@ -7,9 +7,12 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <functional>
 
 #include <tiny_obj_loader.h>
 
+#include <CPU/CPUVoxelizer.h>
+
 struct Material {
     glm::vec3 ambient, diffuse, specular;
     float shininess;
@@ -35,13 +38,27 @@ struct Drawable {
     size_t material_id;
     std::vector<GLuint> indices;
     GLuint ebo;
+    glm::vec3 min, max;
+    // Triangles binned by world space dominant axis, indices axisStart[a] to axisStart[a + 1] are axis a
+    size_t axisStart[4];
 };
 
 class Mesh {
 public:
     Mesh(const std::string &meshname);
 
-    void draw(GLuint program) const;
+    // Drawables whose bounds fall outside the clip volume of cull (projection * view * model) are skipped.
+    // An axis of 0 to 2 only draws the triangles binAxes put in that bin.
+    void draw(GLuint program, const glm::mat4 *cull = nullptr, int axis = -1) const;
+    // Sorts each drawable's triangles by the dominant axis of their normal under model, like voxelize.geom
+    // picks it, so voxelization can draw each axis without a geometry shader
+    void binAxes(const glm::mat4 &model);
+    // Compute access to the triangles: binds the vertices and each drawable's indices as shader storage
+    // buffers 2 and 3 with its diffuse texture on unit 0, then calls dispatch with the drawable's triangle count
+    void dispatch(const std::function<void(GLuint triangles)> &dispatch) const;
+    // CPU voxelizer input for each drawable under model. Diffuse textures are decoded into images, keyed by file,
+    // the first time one is used. The triangles point into the mesh and images, which have to outlive them.
+    void getTriangles(const glm::mat4 &model, std::vector<CPUTriangles> &triangles, std::map<std::string, CPUImage> &images) const;
 
     void loadMesh(const std::string &meshname);
 
@@ -58,11 +75,13 @@ private:
     std::map<std::string, GLuint> textures;
     std::vector<Drawable> drawables;
     std::vector<Vertex> vertices;
+    // Directory texture names are relative to
+    std::string basedir;
 
     glm::vec3 min, max;
     float radius;
 
-    GLuint vao;
+    GLuint vao, vbo;
 };
 
 #endif
@@ -4,6 +4,7 @@
 #include <Graphics/GLHelper.h>
 
 #include <Graphics/opengl.h>
+#include <algorithm>
 #include <cmath>
 #include <climits>
 #include <ctime>
@@ -29,6 +30,8 @@
 static int overview(struct nk_context *ctx);
 
 static GLuint voxelSlice = 0;
+// Slice size, reallocated when the voxel grid is resized
+static int voxelSliceWidth = 0, voxelSliceHeight = 0;
 static struct nk_image voxelSliceImage;
 
 Overlay::Overlay(GLFWwindow *window, Application &app)
@@ -54,6 +57,8 @@ Overlay::~Overlay() {
 }
 
 void Overlay::render(float dt) {
+    // Cone sample counting costs atomics in every shaded pixel, only pay for it while the readout is open
+    app.coneStats = false;
     if (!this->enabled) return;
 
     nk_glfw3_new_frame();
@@ -63,7 +68,13 @@ void Overlay::render(float dt) {
     const Camera &camera = app.camera;
     Settings &settings = app.settings;
 
+    if (voxelSlice != 0 && (voxelSliceWidth != app.voxelDims.x || voxelSliceHeight != app.voxelDims.y)) {
+        glDeleteTextures(1, &voxelSlice);
+        voxelSlice = 0;
+    }
     if (voxelSlice == 0) {
+        voxelSliceWidth = app.voxelDims.x;
+        voxelSliceHeight = app.voxelDims.y;
         glGenTextures(1, &voxelSlice);
         glBindTexture(GL_TEXTURE_2D, voxelSlice);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -71,7 +82,7 @@ void Overlay::render(float dt) {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         GLenum format = app.useRGBA16f ? GL_RGBA16F : GL_RGBA8;
-        glTexStorage2D(GL_TEXTURE_2D, 1, format, app.voxelDim, app.voxelDim);
+        glTexStorage2D(GL_TEXTURE_2D, 1, format, voxelSliceWidth, voxelSliceHeight);
         glBindTexture(GL_TEXTURE_2D, 0);
 
         voxelSliceImage = nk_image_id((int)voxelSlice);
@@ -95,13 +106,56 @@ void Overlay::render(float dt) {
             totalMem /= 1024;
             availableMem /= 1024;
             nk_labelf(ctx, NK_TEXT_LEFT, "GPU Memory Usage: %d / %d MB", totalMem - availableMem, totalMem);
+			app.coneStats = true;
+			nk_labelf(ctx, NK_TEXT_LEFT, "Cone Samples: %.1f / px (%.1f / traced px)", app.samplesPerPixel, app.samplesPerTracedPixel);
+			if (settings.occupancySkipping) {
+				nk_labelf(ctx, NK_TEXT_LEFT, "Samples Saved: %.1f / px", app.samplesSavedPerPixel);
+			}
 
 			if (nk_tree_push(ctx, NK_TREE_NODE, "Timing Breakdown", NK_MINIMIZED)) {
-				nk_labelf(ctx, NK_TEXT_LEFT, "Voxelize: %.2f ms", app.voxelizeTimer.getTime() / 1.0e6);
-				nk_labelf(ctx, NK_TEXT_LEFT, "Shadowmap: %.2f ms", app.shadowmapTimer.getTime() / 1.0e6);
-				nk_labelf(ctx, NK_TEXT_LEFT, "Radiance: %.2f ms", app.radianceTimer.getTime() / 1.0e6);
-				nk_labelf(ctx, NK_TEXT_LEFT, "Mipmap: %.2f ms", app.mipmapTimer.getTime() / 1.0e6);
+				// Passes whose inputs did not change are skipped, see Application::render
+				auto passTime = [&](const char *name, const GLBufferedTimer &timer, bool skipped) {
+					if (skipped) {
+						nk_labelf(ctx, NK_TEXT_LEFT, "%s: skipped", name);
+					}
+					else {
+						nk_labelf(ctx, NK_TEXT_LEFT, "%s: %.2f ms", name, timer.getTime() / 1.0e6);
+					}
+				};
+				passTime("Voxelize", app.voxelizeTimer, app.voxelizeSkipped);
+				if (!settings.clipmap && !settings.sparseOctree) {
+					nk_labelf(ctx, NK_TEXT_LEFT, "  Grid: %dx%dx%d, %s, %.1f MB", app.voxelDims.x, app.voxelDims.y, app.voxelDims.z,
+						VOXEL_STORAGE_NAMES[app.voxelStorage], app.voxelGridMemory() / (1024.0 * 1024.0));
+					if (!app.voxelNormal && !app.staticVoxelNormal) {
+						double normalBytes = (double)app.voxelDims.x * app.voxelDims.y * app.voxelDims.z * (app.useRGBA16f ? 8 : 4);
+						nk_labelf(ctx, NK_TEXT_LEFT, "  Full and static normals dropped, %.1f MB freed", 2 * normalBytes / (1024.0 * 1024.0));
+					}
+					// Fill ratio of the occupied voxel and brick lists the indirect passes run over
+					double voxels = (double)app.voxelDims.x * app.voxelDims.y * app.voxelDims.z;
+					nk_labelf(ctx, NK_TEXT_LEFT, "  Occupied: %u voxels (%.2f%%), %u bricks (%.2f%%)",
+						app.listedVoxels, 100.0 * app.listedVoxels / voxels, app.listedBricks, 100.0 * app.listedBricks / (voxels / 64));
+					if (settings.sortedVoxelization && app.fragmentSort.isInitialized()) {
+						nk_labelf(ctx, NK_TEXT_LEFT, "  Sorted: %u fragments, %.1f MB", app.fragmentSort.getFragmentCount(), app.fragmentSort.getAllocatedMemory() / (1024.0 * 1024.0));
+					}
+				}
+				if (settings.clipmap && !app.voxelizeSkipped) {
+					nk_labelf(ctx, NK_TEXT_LEFT, "  Clipmap: %d voxels updated", app.clipmapVoxelsUpdated);
+				}
+				if (settings.sparseOctree && app.octree.isInitialized()) {
+					// Dense equivalent: color and normal at 8 bytes per voxel, radiance at 4 with mips
+					double denseVoxels = std::pow(2.0, 3 * app.octree.getDepth());
+					nk_labelf(ctx, NK_TEXT_LEFT, "  Octree: %u nodes from %u fragments", app.octree.getNodeCount(), app.octree.getFragmentCount());
+					nk_labelf(ctx, NK_TEXT_LEFT, "  Octree memory: %.1f MB used, %.1f MB allocated (dense %.0f MB)",
+						app.octree.getUsedMemory() / 1.0e6, app.octree.getAllocatedMemory() / 1.0e6, denseVoxels * (16 + 4 * 8.0 / 7.0) / 1.0e6);
+				}
+				passTime("Normalize", app.normalizeTimer, app.normalizeSkipped);
+				nk_labelf(ctx, NK_TEXT_LEFT, "Shadowmap: %.2f ms (%d layers redrawn)", app.shadowmapTimer.getTime() / 1.0e6, app.shadowLayersDrawn);
+				passTime("Radiance", app.radianceTimer, app.radianceSkipped);
+				passTime("Mipmap", app.mipmapTimer, app.mipmapSkipped);
 				nk_labelf(ctx, NK_TEXT_LEFT, "Render: %.2f ms", app.renderTimer.getTime() / 1.0e6);
+				if (settings.deferred) {
+					nk_labelf(ctx, NK_TEXT_LEFT, "  Indirect: %.2f ms", app.indirectTimer.getTime() / 1.0e6);
+				}
 				nk_labelf(ctx, NK_TEXT_LEFT, "Total: %.2f ms", app.totalTimer.getTime() / 1.0e6);
 
 				nk_tree_pop(ctx);
@@ -145,6 +199,9 @@ void Overlay::render(float dt) {
             nk_checkbox_label(ctx, "Radiance", &settings.drawRadiance);
             // nk_checkbox_label(ctx, "Axes", &settings.drawAxes);
             nk_checkbox_label(ctx, "Shadowmap", &settings.drawShadowmap);
+            if (settings.drawShadowmap) {
+                nk_property_int(ctx, "Shadowmap Layer", 0, &settings.shadowmapLayer, Application::MAX_SHADOW_CASCADES, 1, 1);
+            }
             nk_checkbox_label(ctx, "Raymarch", &settings.raymarch);
 
             nk_layout_row_dynamic(ctx, rowheight, 2);
@@ -159,11 +216,12 @@ void Overlay::render(float dt) {
                 static int slice = 0;
                 nk_layout_row_dynamic(ctx, rowheight, 2);
                 nk_labelf(ctx, NK_TEXT_LEFT, "Slice %d", slice);
-                nk_slider_int(ctx, 0, &slice, app.voxelDim - 1, 1);
+                slice = std::min(slice, app.voxelDims.z - 1);
+                nk_slider_int(ctx, 0, &slice, app.voxelDims.z - 1, 1);
                 glCopyImageSubData(
                     app.voxelColor, GL_TEXTURE_3D, 0, 0, 0, slice,
                     voxelSlice, GL_TEXTURE_2D, 0, 0, 0, 0,
-                    app.voxelDim, app.voxelDim, 1
+                    voxelSliceWidth, voxelSliceHeight, 1
                 );
 
                 nk_layout_row_static(ctx, 64, 64, 1);
@@ -181,11 +239,87 @@ void Overlay::render(float dt) {
 			if (GLAD_GL_NV_conservative_raster) {
 				nk_checkbox_label(ctx, "Conservative Rasterization", &settings.conservativeRasterization);
 			}
+			nk_checkbox_label(ctx, "Skip Unchanged GI Passes", &settings.skipUnchangedGI);
+			nk_checkbox_label(ctx, "Animate Nanosuit", &settings.animateNanosuit);
+			// Clipmap and octree each replace the dense grid, only one at a time
+			if (nk_checkbox_label(ctx, "Voxel Clipmap", &settings.clipmap) && settings.clipmap) {
+				settings.sparseOctree = false;
+			}
+			if (nk_checkbox_label(ctx, "Sparse Voxel Octree", &settings.sparseOctree) && settings.sparseOctree) {
+				settings.clipmap = false;
+			}
+			if (settings.sparseOctree) {
+				nk_property_int(ctx, "Octree Depth", SparseVoxelOctree::MIN_DEPTH, &settings.octreeDepth, SparseVoxelOctree::MAX_DEPTH, 1, 1);
+			}
+			nk_checkbox_label(ctx, "Fit Voxel Grid to Scene", &settings.fitVoxelGrid);
+			if (nk_checkbox_label(ctx, "Axis Binned Voxelization", &settings.axisBinnedVoxelization)) {
+				app.voxelsDirty = true;
+			}
+			if (nk_checkbox_label(ctx, "Compute Voxelization", &settings.computeVoxelization)) {
+				app.voxelsDirty = true;
+			}
+			if (nk_button_label(ctx, "Compare CPU Voxelization")) {
+				app.compareCPUVoxelization();
+			}
+			if (nk_button_label(ctx, "Compare CPU Mipmaps")) {
+				app.compareCPUMips();
+			}
+			if (nk_checkbox_label(ctx, "Sorted Voxelization", &settings.sortedVoxelization)) {
+				app.voxelsDirty = true;
+			}
+			// Applied by Application::render, which recompiles the shaders and reallocates the grid
+			nk_property_int(ctx, "Voxel Storage", 0, &settings.voxelStorage, VOXEL_STORAGE_COUNT - 1, 1, 1);
+			if (app.packedStorage() && nk_checkbox_label(ctx, "Drop Full + Static Normals", &settings.dropVoxelNormal)) {
+				app.voxelsDirty = true;
+			}
+			if (!app.useRGBA16f && !settings.sortedVoxelization && nk_checkbox_label(ctx, "CAS Averaging", &settings.casAveraging)) {
+				app.voxelsDirty = true;
+			}
+			nk_property_int(ctx, "Voxel Resolution", 64, &settings.voxelResolution, 512, 32, 32);
+			if (nk_checkbox_label(ctx, "Single Pass Mipmaps", &settings.singlePassMips)) {
+				app.mipsDirty = true;
+			}
+			if (nk_checkbox_label(ctx, "Skip Empty Space", &settings.occupancySkipping)) {
+				app.mipsDirty = true;
+			}
+			nk_checkbox_label(ctx, "Distance Field Tracing", &settings.distanceField);
+			if (nk_checkbox_label(ctx, "Active Voxel Lists", &settings.activeVoxelLists)) {
+				app.mipsDirty = true;
+			}
+			nk_checkbox_label(ctx, "Clear Free Radiance", &settings.clearFreeRadiance);
+			if (nk_checkbox_label(ctx, "Per Voxel Injection", &settings.voxelInjection)) {
+				app.radianceDirty = true;
+			}
 			nk_checkbox_label(ctx, "Enable Shadows", &settings.enableShadows);
+			if (settings.enableShadows) {
+				nk_checkbox_label(ctx, "Cache Static Shadows", &settings.cacheShadows);
+				nk_property_int(ctx, "Shadowmap Size", 1024, &settings.shadowmapSize, 4096, 1024, 1024);
+				nk_property_int(ctx, "Shadow Cascades", 1, &settings.shadowCascades, Application::MAX_SHADOW_CASCADES, 1, 1);
+				nk_property_float(ctx, "Shadow Distance", 5.0f, &settings.shadowDistance, 100.0f, 1.0f, 0.5f);
+				nk_property_float(ctx, "Split Lambda", 0.0f, &settings.cascadeSplitLambda, 1.0f, 0.05f, 0.01f);
+			}
 			nk_checkbox_label(ctx, "Enable Normal Map", &settings.enableNormalMap);
 			nk_checkbox_label(ctx, "Enable Indirect", &settings.enableIndirect);
 			nk_checkbox_label(ctx, "Enable Diffuse", &settings.enableDiffuse);
 			nk_checkbox_label(ctx, "Enable Specular", &settings.enableSpecular);
+			nk_checkbox_label(ctx, "Deferred Shading", &settings.deferred);
+			if (!settings.deferred) {
+				nk_checkbox_label(ctx, "Depth Prepass", &settings.depthPrepass);
+			}
+			else {
+				nk_checkbox_label(ctx, "Reduced Res Indirect", &settings.reducedIndirect);
+				if (settings.reducedIndirect) {
+					nk_checkbox_label(ctx, "Checkerboard", &settings.checkerboardIndirect);
+					if (!settings.checkerboardIndirect) {
+						nk_property_int(ctx, "Indirect Scale", 2, &settings.indirectScale, 4, 2, 2);
+					}
+				}
+				nk_checkbox_label(ctx, "Temporal Indirect", &settings.temporalIndirect);
+				if (settings.temporalIndirect) {
+					nk_property_int(ctx, "Cones per Frame", 1, &settings.temporalCones, 4, 1, 1);
+					nk_property_float(ctx, "Temporal Blend", 0.01f, &settings.temporalBlend, 1.0f, 0.01f, 0.01f);
+				}
+			}
             
             nk_layout_row_dynamic(ctx, rowheight, 2);
             nk_labelf(ctx, NK_TEXT_LEFT, "Ambient Scale: %0.1f", settings.ambientScale);
@@ -196,6 +330,10 @@ void Overlay::render(float dt) {
             nk_property_float(ctx, "vctBias", 0.0f, &settings.vctBias, 10.0f, 0.1f, 0.05f);
             nk_property_float(ctx, "vctConeAngle", 0.0f, &settings.vctConeAngle, 10.0f, 0.1f, 0.05f);
             nk_property_float(ctx, "vctLodOffset", 0.0f, &settings.vctLodOffset, 4.0f, 0.1f, 0.05f);
+            nk_checkbox_label(ctx, "Adaptive Cones", &settings.adaptiveCones);
+            if (settings.adaptiveCones) {
+                nk_property_float(ctx, "Cone Budget", 1.0f, &settings.coneBudget, 80.0f, 1.0f, 1.0f);
+            }
             nk_layout_row_dynamic(ctx, rowheight, 1);
             nk_property_float(ctx, "vctConeInitialHeight", 0.0f, &settings.vctConeInitialHeight, 10.0f, 0.1f, 0.05f);
 
@@ -8,6 +8,7 @@
 #include <vector>
 #include <memory>
 #include <initializer_list>
+#include <limits>
 
 #include "Graphics/Mesh.h"
 
@@ -18,14 +19,89 @@ Scene::Scene(std::initializer_list<const std::string> meshnames) {
 	}
 }
 
-void Scene::addMesh(const std::string &meshname, const glm::mat4 &model) {
-	nodes.push_back({std::make_unique<Mesh>(meshname), model});
+size_t Scene::addMesh(const std::string &meshname, const glm::mat4 &model, bool dynamic) {
+	nodes.push_back({std::make_unique<Mesh>(meshname), model, dynamic});
+	version++;
+	if (dynamic) {
+		dynamicNodes++;
+	}
+	else {
+		// Static nodes are binned once, dynamic ones keep the geometry shader
+		nodes.back().mesh->binAxes(model);
+		staticVersion++;
+	}
+	return nodes.size() - 1;
+}
+
+void Scene::draw(GLuint program, const glm::mat4 *viewProjection, Filter filter) const {
+	for (const auto &node : nodes) {
+		if ((filter == Filter::Static && node.dynamic) || (filter == Filter::Dynamic && !node.dynamic)) continue;
+
+		glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(node.model));
+		if (viewProjection) {
+			glm::mat4 cull = *viewProjection * node.model;
+			node.mesh->draw(program, &cull);
+		}
+		else {
+			node.mesh->draw(program);
+		}
+	}
+}
+
+void Scene::drawAxis(GLuint program, int axis, const glm::mat4 *viewProjection) const {
+	for (const auto &node : nodes) {
+		if (node.dynamic) continue;
+
+		glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(node.model));
+		if (viewProjection) {
+			glm::mat4 cull = *viewProjection * node.model;
+			node.mesh->draw(program, &cull, axis);
+		}
+		else {
+			node.mesh->draw(program, nullptr, axis);
+		}
+	}
 }
 
-void Scene::draw(GLuint program) const {
+void Scene::dispatch(GLuint program, const std::function<void(GLuint triangles)> &dispatch, Filter filter) const {
 	for (const auto &node : nodes) {
+		if ((filter == Filter::Static && node.dynamic) || (filter == Filter::Dynamic && !node.dynamic)) continue;
+
 		glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(node.model));
-		node.mesh->draw(program);
+		node.mesh->dispatch(dispatch);
+	}
+}
+
+void Scene::getTriangles(std::vector<CPUTriangles> &triangles, std::map<std::string, CPUImage> &images, Filter filter) const {
+	for (const auto &node : nodes) {
+		if ((filter == Filter::Static && node.dynamic) || (filter == Filter::Dynamic && !node.dynamic)) continue;
+
+		node.mesh->getTriangles(node.model, triangles, images);
+	}
+}
+
+void Scene::setTransform(size_t node, const glm::mat4 &model) {
+	nodes[node].model = model;
+	version++;
+	if (!nodes[node].dynamic) {
+		nodes[node].mesh->binAxes(model);
+		staticVersion++;
+	}
+}
+
+void Scene::getBounds(glm::vec3 &min, glm::vec3 &max, Filter filter) const {
+	min = glm::vec3(std::numeric_limits<float>::max());
+	max = glm::vec3(-std::numeric_limits<float>::max());
+	for (const auto &node : nodes) {
+		if ((filter == Filter::Static && node.dynamic) || (filter == Filter::Dynamic && !node.dynamic)) continue;
+
+		const glm::vec3 &meshMin = node.mesh->getMin(), &meshMax = node.mesh->getMax();
+		for (int i = 0; i < 8; i++) {
+			glm::vec3 corner(i & 1 ? meshMax.x : meshMin.x, i & 2 ? meshMax.y : meshMin.y, i & 4 ? meshMax.z : meshMin.z);
+			corner = glm::vec3(node.model * glm::vec4(corner, 1.0f));
+			min = glm::min(min, corner);
+			max = glm::max(max, corner);
+		}
 	}
 }
 
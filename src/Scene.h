@@ -8,6 +8,8 @@
 #include <vector>
 #include <memory>
 #include <initializer_list>
+#include <functional>
+#include <map>
 
 #include <Graphics/Mesh.h>
 
@@ -20,9 +22,27 @@ public:
 	Scene();
 	Scene(std::initializer_list<const std::string> meshnames);
 
+	// Which nodes to draw, static nodes never move after being added
+	enum class Filter { All, Static, Dynamic };
+
 	// TODO: option to add local transform, normalize to ndc after loading, error handling (in mesh.cpp)
-	void addMesh(const std::string &meshname, const glm::mat4 &model = glm::mat4());
-	void draw(GLuint program) const;
+	// Returns the node's index for setTransform
+	size_t addMesh(const std::string &meshname, const glm::mat4 &model = glm::mat4(), bool dynamic = false);
+	// viewProjection, if given, culls drawables outside its clip volume
+	void draw(GLuint program, const glm::mat4 *viewProjection = nullptr, Filter filter = Filter::All) const;
+	// Draws the static nodes' triangles whose dominant axis is axis in world space, binned when they were added
+	void drawAxis(GLuint program, int axis, const glm::mat4 *viewProjection = nullptr) const;
+	// Sets each filtered node's model matrix on program and hands its drawables to dispatch, see Mesh::dispatch
+	void dispatch(GLuint program, const std::function<void(GLuint triangles)> &dispatch, Filter filter = Filter::All) const;
+	// The filtered nodes' drawables as CPU voxelizer input, see Mesh::getTriangles
+	void getTriangles(std::vector<CPUTriangles> &triangles, std::map<std::string, CPUImage> &images, Filter filter = Filter::All) const;
+	bool hasDynamicNodes() const { return dynamicNodes > 0; }
+	// Change whenever any geometry, or only static geometry, is added, for invalidating anything cached from it
+	unsigned int getVersion() const { return version; }
+	unsigned int getStaticVersion() const { return staticVersion; }
+	// World space bounds of the filtered meshes
+	void getBounds(glm::vec3 &min, glm::vec3 &max, Filter filter = Filter::All) const;
+	void setTransform(size_t node, const glm::mat4 &model);
 
 	Light &getMainlight() { return mainlight; }
 	void setMainlight(const glm::vec3 &position, const glm::vec3 &direction, const glm::vec3 &intensity);
@@ -31,9 +51,12 @@ private:
 	struct SceneNode {
 		std::unique_ptr<Mesh> mesh;
 		glm::mat4 model;
+		bool dynamic;
 	};
 
 	std::vector<SceneNode> nodes;
+	int dynamicNodes = 0;
+	unsigned int version = 0, staticVersion = 0;
 	Light mainlight;
 };
 
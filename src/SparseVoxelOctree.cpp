@@ -0,0 +1,217 @@
+#include "SparseVoxelOctree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "common.h"
+
+// The passes loop over their items, so the grid only has to be big enough to fill the GPU
+static GLuint workGroups(GLuint count) {
+	return std::max(1u, std::min((count + 64 - 1) / 64, 65535u));
+}
+
+SparseVoxelOctree::~SparseVoxelOctree() {
+	if (isInitialized()) {
+		GLuint buffers[] = { fragmentList, nodePool, tileCounter, leafValues };
+		glDeleteBuffers(4, buffers);
+		glDeleteTextures(1, &brickPool);
+	}
+}
+
+void SparseVoxelOctree::loadPrograms() {
+	flagProgram.attachAndLinkAsync({SHADER_DIR "svoFlag.comp"});
+	flagProgram.setObjectLabel("SVO Flag");
+	allocProgram.attachAndLinkAsync({SHADER_DIR "svoAlloc.comp"});
+	allocProgram.setObjectLabel("SVO Alloc");
+	leavesProgram.attachAndLinkAsync({SHADER_DIR "svoLeaves.comp"});
+	leavesProgram.setObjectLabel("SVO Leaves");
+	injectProgram.attachAndLinkAsync({SHADER_DIR "svoInject.comp"});
+	injectProgram.setObjectLabel("SVO Inject");
+	filterProgram.attachAndLinkAsync({SHADER_DIR "svoFilter.comp"});
+	filterProgram.setObjectLabel("SVO Filter");
+}
+
+std::vector<GLShaderProgram *> SparseVoxelOctree::getPrograms() {
+	return { &flagProgram, &allocProgram, &leavesProgram, &injectProgram, &filterProgram };
+}
+
+void SparseVoxelOctree::init(GLuint tileCapacity) {
+	this->tileCapacity = tileCapacity;
+
+	glCreateBuffers(1, &nodePool);
+	glNamedBufferStorage(nodePool, (GLsizeiptr)tileCapacity * 8 * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glCreateBuffers(1, &tileCounter);
+	glNamedBufferStorage(tileCounter, sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+	// Grown as needed
+	glCreateBuffers(1, &fragmentList);
+	glCreateBuffers(1, &leafValues);
+	allocateFragmentList(1 << 20);
+	leafCapacity = 8;
+	glNamedBufferData(leafValues, (GLsizeiptr)leafCapacity * 8 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+	// A 2x2x2 brick per tile
+	brickDim = (int)std::ceil(std::cbrt((double)tileCapacity));
+	glCreateTextures(GL_TEXTURE_3D, 1, &brickPool);
+	glTextureParameteri(brickPool, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTextureParameteri(brickPool, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureParameteri(brickPool, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(brickPool, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(brickPool, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTextureStorage3D(brickPool, 1, GL_RGBA8, 2 * brickDim, 2 * brickDim, 2 * brickDim);
+	glClearTexImage(brickPool, 0, GL_RGBA, GL_FLOAT, nullptr);
+}
+
+void SparseVoxelOctree::allocateFragmentList(GLuint capacity) {
+	fragmentCapacity = capacity;
+	// Count and capacity, then 3 uints per fragment
+	glNamedBufferData(fragmentList, 2 * sizeof(GLuint) + (GLsizeiptr)capacity * 3 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+}
+
+void SparseVoxelOctree::beginFragments() {
+	const GLuint header[2] = { 0, fragmentCapacity };
+	glNamedBufferSubData(fragmentList, 0, sizeof(header), header);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, fragmentList);
+}
+
+bool SparseVoxelOctree::endFragments() {
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glGetNamedBufferSubData(fragmentList, 0, sizeof(GLuint), &fragmentCount);
+
+	if (fragmentCount > fragmentCapacity) {
+		LOG_INFO("Growing voxel fragment list to ", fragmentCount, " fragments");
+		allocateFragmentList(fragmentCount + fragmentCount / 4);
+		return false;
+	}
+	return true;
+}
+
+void SparseVoxelOctree::build(int depth, const glm::vec3 &min, float size) {
+	this->depth = depth;
+	this->min = min;
+	this->size = size;
+
+	// Only tile 0, the children of the root, exists to begin with
+	glClearNamedBufferData(nodePool, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	const GLuint one = 1;
+	glNamedBufferSubData(tileCounter, 0, sizeof(one), &one);
+	levelStarts.assign(depth + 2, 0);
+	levelStarts[2] = 1;
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, fragmentList);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, nodePool);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, tileCounter);
+
+	// Flag the nodes of a level that contain fragments, then give each flagged node a tile of children.
+	// The tile count is read back to size the next level's dispatch, the build only runs when geometry changes.
+	bool exhausted = false;
+	for (int level = 1; level < depth; level++) {
+		flagProgram.bind();
+		setUniforms(flagProgram);
+		flagProgram.setUniform1i("level", level);
+		glDispatchCompute(workGroups(fragmentCount), 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		GLuint nodeOffset = levelStarts[level] * 8, nodeCount = (levelStarts[level + 1] - levelStarts[level]) * 8;
+		allocProgram.bind();
+		allocProgram.setUniform1ui("nodeOffset", nodeOffset);
+		allocProgram.setUniform1ui("nodeCount", nodeCount);
+		allocProgram.setUniform1ui("tileCapacity", tileCapacity);
+		glDispatchCompute(workGroups(nodeCount), 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		GLuint count;
+		glGetNamedBufferSubData(tileCounter, 0, sizeof(count), &count);
+		if (count > tileCapacity) {
+			exhausted = true;
+			count = tileCapacity;
+		}
+		levelStarts[level + 2] = count;
+	}
+	tileCount = levelStarts[depth + 1];
+	if (exhausted) {
+		LOG_WARN("Octree node pool full at ", tileCapacity * 8, " nodes, some branches stop early");
+	}
+
+	// Leaves average the fragments that fall into them
+	GLuint leafOffset = levelStarts[depth] * 8, leafCount = (levelStarts[depth + 1] - levelStarts[depth]) * 8;
+	if (leafCount > leafCapacity) {
+		leafCapacity = leafCount + leafCount / 4;
+		glNamedBufferData(leafValues, (GLsizeiptr)leafCapacity * 8 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+	}
+	glClearNamedBufferSubData(leafValues, GL_R32UI, 0, (GLsizeiptr)leafCount * 8 * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, leafValues);
+
+	leavesProgram.bind();
+	setUniforms(leavesProgram);
+	leavesProgram.setUniform1ui("nodeOffset", leafOffset);
+	leavesProgram.setUniform1ui("nodeCount", leafCount);
+	glDispatchCompute(workGroups(fragmentCount), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	leavesProgram.unbind();
+
+	for (GLuint binding = 1; binding <= 4; binding++) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+	}
+}
+
+void SparseVoxelOctree::inject(GLuint shadowmap, const glm::mat4 *shadowMatrices, int matrixCount, int shadowCascades, const glm::vec3 &lightPos, const glm::vec3 &lightInt) {
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, nodePool);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, leafValues);
+	glBindImageTexture(0, brickPool, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA8);
+
+	GLuint leafOffset = levelStarts[depth] * 8, leafCount = (levelStarts[depth + 1] - levelStarts[depth]) * 8;
+	injectProgram.bind();
+	setUniforms(injectProgram);
+	glBindTextureUnit(1, shadowmap);
+	injectProgram.setUniform1i("shadowmap", 1);
+	injectProgram.setUniformMatrix4fv("shadowMatrices", shadowMatrices, matrixCount);
+	injectProgram.setUniform1i("shadowCascades", shadowCascades);
+	injectProgram.setUniform3fv("lightPos", lightPos);
+	injectProgram.setUniform3fv("lightInt", lightInt);
+	injectProgram.setUniform1ui("nodeOffset", leafOffset);
+	injectProgram.setUniform1ui("nodeCount", leafCount);
+	glDispatchCompute(workGroups(leafCount), 1, 1);
+	glBindTextureUnit(1, 0);
+
+	// Each level reads the one below it
+	filterProgram.bind();
+	for (int level = depth - 1; level >= 1; level--) {
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		GLuint nodeOffset = levelStarts[level] * 8, nodeCount = (levelStarts[level + 1] - levelStarts[level]) * 8;
+		filterProgram.setUniform1ui("nodeOffset", nodeOffset);
+		filterProgram.setUniform1ui("nodeCount", nodeCount);
+		glDispatchCompute(workGroups(nodeCount), 1, 1);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	filterProgram.unbind();
+
+	glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA8);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
+}
+
+void SparseVoxelOctree::setUniforms(GLShaderProgram &p) const {
+	p.setUniform1i("svoDepth", depth);
+	p.setUniform3fv("svoMin", min);
+	p.setUniform1f("svoSize", size);
+}
+
+void SparseVoxelOctree::bindTracing(GLShaderProgram &p, GLuint textureUnit) const {
+	setUniforms(p);
+	glBindTextureUnit(textureUnit, brickPool);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, nodePool);
+}
+
+size_t SparseVoxelOctree::getUsedMemory() const {
+	// Node pointer, brick texel and, for leaves, two uvec4 of sums per node
+	size_t leaves = depth > 0 ? (size_t)(levelStarts[depth + 1] - levelStarts[depth]) * 8 : 0;
+	return (size_t)getNodeCount() * 2 * sizeof(GLuint) + leaves * 8 * sizeof(GLuint);
+}
+
+size_t SparseVoxelOctree::getAllocatedMemory() const {
+	size_t bricks = (size_t)8 * brickDim * brickDim * brickDim * 4;
+	return (size_t)tileCapacity * 8 * sizeof(GLuint) + bricks + (size_t)leafCapacity * 8 * sizeof(GLuint)
+		+ (size_t)fragmentCapacity * 3 * sizeof(GLuint);
+}
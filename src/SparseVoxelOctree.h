@@ -0,0 +1,75 @@
+#ifndef SPARSEVOXELOCTREE_H
+#define SPARSEVOXELOCTREE_H
+
+#include <Graphics/opengl.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "Graphics/GLShaderProgram.h"
+
+// Sparse voxel octree built on the GPU, after the OpenGL Insights sparse voxelization chapter. The scene is
+// voxelized into a fragment list, nodes are subdivided level by level where there are fragments, leaves
+// average their fragments and the levels above are filtered bottom-up into a brick pool. Memory follows
+// the surface area of the scene rather than the volume, see svo.glsl for the layout.
+class SparseVoxelOctree {
+public:
+	static constexpr int MIN_DEPTH = 5, MAX_DEPTH = 10;
+
+	SparseVoxelOctree() = default;
+	~SparseVoxelOctree();
+
+	SparseVoxelOctree(const SparseVoxelOctree &other) = delete;
+	SparseVoxelOctree &operator=(const SparseVoxelOctree &other) = delete;
+
+	// Submits the build shaders, before init so they compile in the background
+	void loadPrograms();
+	std::vector<GLShaderProgram *> getPrograms();
+
+	// Allocates the pools, tileCapacity bounds the number of nodes to 8 per tile
+	void init(GLuint tileCapacity);
+	bool isInitialized() const { return nodePool != 0; }
+
+	// Sets up the fragment list for voxelize.frag. endFragments returns false if it overflowed, after
+	// growing it, the scene then has to be voxelized again.
+	void beginFragments();
+	bool endFragments();
+
+	// Subdivides the cube from min with sides size down to depth levels, 2^depth leaves across
+	void build(int depth, const glm::vec3 &min, float size);
+	// Lights the leaves with N.L and the shadowmap and filters every level above them
+	void inject(GLuint shadowmap, const glm::mat4 *shadowMatrices, int matrixCount, int shadowCascades, const glm::vec3 &lightPos, const glm::vec3 &lightInt);
+
+	// svoDepth, svoMin and svoSize from svo.glsl
+	void setUniforms(GLShaderProgram &p) const;
+	// Node pool and brick pool for tracing in vct.glsl
+	void bindTracing(GLShaderProgram &p, GLuint textureUnit) const;
+
+	int getDepth() const { return depth; }
+	GLuint getNodeCount() const { return tileCount * 8; }
+	GLuint getFragmentCount() const { return fragmentCount; }
+	// Bytes of the pools in use, and allocated including the fragment list
+	size_t getUsedMemory() const;
+	size_t getAllocatedMemory() const;
+
+private:
+	GLShaderProgram flagProgram, allocProgram, leavesProgram, injectProgram, filterProgram;
+
+	GLuint fragmentList = 0, nodePool = 0, tileCounter = 0, leafValues = 0;
+	GLuint brickPool = 0;
+	GLuint tileCapacity = 0, fragmentCapacity = 0, leafCapacity = 0;
+	int brickDim = 0;
+
+	int depth = 0;
+	glm::vec3 min{0.0f};
+	float size = 0.0f;
+	GLuint fragmentCount = 0, tileCount = 0;
+	// First tile of each level, levelStarts[l] to levelStarts[l + 1] are the tiles of level l
+	std::vector<GLuint> levelStarts;
+
+	void allocateFragmentList(GLuint capacity);
+};
+
+#endif
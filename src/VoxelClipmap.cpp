@@ -0,0 +1,125 @@
+#include "VoxelClipmap.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include "common.h"
+
+static GLuint makeClipmapTexture(GLsizei size, GLenum internalFormat, GLint filter) {
+	GLuint handle;
+	glCreateTextures(GL_TEXTURE_3D, 1, &handle);
+
+	// Repeat so sampling wraps around like the toroidal addressing
+	glTextureParameteri(handle, GL_TEXTURE_MIN_FILTER, filter);
+	glTextureParameteri(handle, GL_TEXTURE_MAG_FILTER, filter);
+	glTextureParameteri(handle, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTextureParameteri(handle, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTextureParameteri(handle, GL_TEXTURE_WRAP_R, GL_REPEAT);
+
+	glTextureStorage3D(handle, 1, internalFormat, size, size, size);
+	glClearTexImage(handle, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+	return handle;
+}
+
+VoxelClipmap::~VoxelClipmap() {
+	if (dim > 0) {
+		glDeleteTextures(LEVELS, color);
+		glDeleteTextures(LEVELS, normal);
+		glDeleteTextures(LEVELS, radiance);
+	}
+}
+
+void VoxelClipmap::init(int dim, float voxelSize, GLenum voxelFormat) {
+	if (dim % 2 != 0) {
+		LOG_ERROR("Clipmap dimension must be even, got ", dim);
+		return;
+	}
+	this->dim = dim;
+	this->voxelSize = voxelSize;
+	valid = false;
+
+	for (int level = 0; level < LEVELS; level++) {
+		color[level] = makeClipmapTexture(dim, voxelFormat, GL_NEAREST);
+		normal[level] = makeClipmapTexture(dim, voxelFormat, GL_NEAREST);
+		radiance[level] = makeClipmapTexture(dim, GL_RGBA8, GL_LINEAR);
+	}
+}
+
+std::vector<VoxelClipmap::Region> VoxelClipmap::update(const glm::vec3 &center, bool invalidate) {
+	std::vector<Region> regions;
+
+	for (int level = 0; level < LEVELS; level++) {
+		glm::ivec3 origin = glm::ivec3(glm::floor(center / getVoxelSize(level))) - dim / 2;
+		glm::ivec3 previous = origins[level];
+		origins[level] = origin;
+
+		glm::ivec3 delta = origin - previous;
+		if (!valid || invalidate || std::max(std::abs(delta.x), std::max(std::abs(delta.y), std::abs(delta.z))) >= dim) {
+			regions.push_back({ level, origin, origin + dim });
+			continue;
+		}
+
+		// One slab per axis the level moved along, each excluded from the following ones so no voxel is visited twice
+		glm::ivec3 boxMin = origin, boxMax = origin + dim;
+		for (int axis = 0; axis < 3; axis++) {
+			if (delta[axis] == 0) continue;
+
+			Region slab = { level, boxMin, boxMax };
+			if (delta[axis] > 0) {
+				slab.min[axis] = previous[axis] + dim;
+				boxMax[axis] = slab.min[axis];
+			}
+			else {
+				slab.max[axis] = previous[axis];
+				boxMin[axis] = slab.max[axis];
+			}
+			regions.push_back(slab);
+		}
+	}
+	valid = true;
+
+	return regions;
+}
+
+std::vector<VoxelClipmap::Region> VoxelClipmap::getLevels() const {
+	std::vector<Region> regions;
+	for (int level = 0; level < LEVELS; level++) {
+		regions.push_back({ level, origins[level], origins[level] + dim });
+	}
+	return regions;
+}
+
+void VoxelClipmap::clear(const Region &region) const {
+	// The region wraps around the texture at most once per axis, clear each unwrapped piece
+	int offsets[3][2], sizes[3][2], pieces[3];
+	for (int axis = 0; axis < 3; axis++) {
+		int start = ((region.min[axis] % dim) + dim) % dim;
+		int size = region.max[axis] - region.min[axis];
+		offsets[axis][0] = start;
+		sizes[axis][0] = std::min(size, dim - start);
+		offsets[axis][1] = 0;
+		sizes[axis][1] = size - sizes[axis][0];
+		pieces[axis] = sizes[axis][1] > 0 ? 2 : 1;
+	}
+
+	for (int x = 0; x < pieces[0]; x++) {
+		for (int y = 0; y < pieces[1]; y++) {
+			for (int z = 0; z < pieces[2]; z++) {
+				for (GLuint texture : { color[region.level], normal[region.level], radiance[region.level] }) {
+					glClearTexSubImage(
+						texture, 0, offsets[0][x], offsets[1][y], offsets[2][z],
+						sizes[0][x], sizes[1][y], sizes[2][z], GL_RGBA, GL_FLOAT, nullptr
+					);
+				}
+			}
+		}
+	}
+}
+
+void VoxelClipmap::getBounds(glm::vec3 &min, glm::vec3 &max) const {
+	float size = getVoxelSize(LEVELS - 1);
+	min = glm::vec3(origins[LEVELS - 1]) * size;
+	max = glm::vec3(origins[LEVELS - 1] + dim) * size;
+}
@@ -0,0 +1,59 @@
+#ifndef VOXELCLIPMAP_H
+#define VOXELCLIPMAP_H
+
+#include <Graphics/opengl.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Camera centered voxel grids, each level covering twice the extent of the previous one at the same
+// resolution. Textures are addressed by world voxel coordinate wrapped to dim, so when the camera moves
+// only the slabs a level newly covers have to be revoxelized, the rest stays where it is.
+class VoxelClipmap {
+public:
+	static constexpr int LEVELS = 4;
+
+	// Box of one level in that level's world voxel coordinates, [min, max)
+	struct Region {
+		int level;
+		glm::ivec3 min, max;
+	};
+
+	VoxelClipmap() = default;
+	~VoxelClipmap();
+
+	VoxelClipmap(const VoxelClipmap &other) = delete;
+	VoxelClipmap &operator=(const VoxelClipmap &other) = delete;
+
+	// dim has to be even, voxelSize is the world size of a level 0 voxel
+	void init(int dim, float voxelSize, GLenum voxelFormat);
+	bool isInitialized() const { return dim > 0; }
+
+	// Recenters every level on center and returns the regions whose voxels are stale, disjoint within
+	// a level. Levels are returned whole on the first update, when invalidate is set or after a jump.
+	std::vector<Region> update(const glm::vec3 &center, bool invalidate);
+	// Every level in full
+	std::vector<Region> getLevels() const;
+	// Zeroes color, normal and radiance in the region
+	void clear(const Region &region) const;
+
+	int getDim() const { return dim; }
+	float getVoxelSize(int level) const { return voxelSize * (1 << level); }
+	const glm::ivec3 &getOrigin(int level) const { return origins[level]; }
+	GLuint getColor(int level) const { return color[level]; }
+	GLuint getNormal(int level) const { return normal[level]; }
+	GLuint getRadiance(int level) const { return radiance[level]; }
+	// World space box covered by the coarsest level
+	void getBounds(glm::vec3 &min, glm::vec3 &max) const;
+
+private:
+	int dim = 0;
+	float voxelSize = 0.0f;
+	bool valid = false;
+	glm::ivec3 origins[LEVELS];
+	GLuint color[LEVELS] = {}, normal[LEVELS] = {}, radiance[LEVELS] = {};
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "VoxelFragmentSort.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "common.h"
+
+// Same as radixSort.comp
+enum { STAGE_COUNT, STAGE_SCAN, STAGE_SCATTER };
+static const GLuint RADIX_DIGITS = 16, RADIX_BLOCK = 128 * 16;
+
+static GLuint radixBlocks(GLuint count) {
+	return std::max(1u, (count + RADIX_BLOCK - 1) / RADIX_BLOCK);
+}
+
+VoxelFragmentSort::~VoxelFragmentSort() {
+	if (isInitialized()) {
+		glDeleteBuffers(2, lists);
+		glDeleteBuffers(1, &histogram);
+	}
+}
+
+void VoxelFragmentSort::loadPrograms() {
+	sortProgram.attachAndLinkAsync({SHADER_DIR "radixSort.comp"});
+	sortProgram.setObjectLabel("Radix Sort Fragments");
+	reduceProgram.attachAndLinkAsync({SHADER_DIR "reduceFragments.comp"});
+	reduceProgram.setObjectLabel("Reduce Fragments");
+}
+
+std::vector<GLShaderProgram *> VoxelFragmentSort::getPrograms() {
+	return { &sortProgram, &reduceProgram };
+}
+
+void VoxelFragmentSort::init(GLuint capacity) {
+	// Grown as needed
+	glCreateBuffers(2, lists);
+	glCreateBuffers(1, &histogram);
+	allocate(capacity);
+}
+
+void VoxelFragmentSort::allocate(GLuint capacity) {
+	fragmentCapacity = capacity;
+	// Count and capacity, then 3 uints per fragment, see svoFragments.glsl
+	for (GLuint list : lists) {
+		glNamedBufferData(list, 2 * sizeof(GLuint) + (GLsizeiptr)capacity * 3 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+	}
+	glNamedBufferData(histogram, (GLsizeiptr)radixBlocks(capacity) * RADIX_DIGITS * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+}
+
+void VoxelFragmentSort::beginFragments() {
+	const GLuint header[2] = { 0, fragmentCapacity };
+	glNamedBufferSubData(lists[0], 0, sizeof(header), header);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lists[0]);
+	current = 0;
+}
+
+bool VoxelFragmentSort::endFragments() {
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glGetNamedBufferSubData(lists[0], 0, sizeof(GLuint), &fragmentCount);
+
+	if (fragmentCount > fragmentCapacity) {
+		LOG_INFO("Growing sorted voxel fragment list to ", fragmentCount, " fragments");
+		allocate(fragmentCount + fragmentCount / 4);
+		return false;
+	}
+	// Both lists carry the count, each pass reads it from its source
+	glCopyNamedBufferSubData(lists[0], lists[1], 0, 0, 2 * sizeof(GLuint));
+	return true;
+}
+
+void VoxelFragmentSort::sort(int keyBits) {
+	GLuint blocks = radixBlocks(fragmentCount);
+	sortProgram.bind();
+	sortProgram.setUniform1ui("blocks", blocks);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, histogram);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	for (int shift = 0; shift < keyBits; shift += 4) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lists[current]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, lists[1 - current]);
+		sortProgram.setUniform1ui("shift", (GLuint)shift);
+
+		sortProgram.setUniform1i("stage", STAGE_COUNT);
+		glDispatchCompute(blocks, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		sortProgram.setUniform1i("stage", STAGE_SCAN);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		sortProgram.setUniform1i("stage", STAGE_SCATTER);
+		glDispatchCompute(blocks, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		current = 1 - current;
+	}
+
+	for (GLuint binding = 1; binding <= 3; binding++) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+	}
+	sortProgram.unbind();
+}
+
+void VoxelFragmentSort::reduce(GLuint color, GLuint normal, GLenum voxelFormat) {
+	reduceProgram.bind();
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lists[current]);
+	glBindImageTexture(0, color, 0, GL_TRUE, 0, GL_WRITE_ONLY, voxelFormat);
+	glBindImageTexture(1, normal, 0, GL_TRUE, 0, GL_WRITE_ONLY, voxelFormat);
+
+	// The pass loops over the fragments, the grid only has to fill the GPU
+	glDispatchCompute(std::max(1u, std::min((fragmentCount + 64 - 1) / 64, 65535u)), 1, 1);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+	glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, voxelFormat);
+	glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, voxelFormat);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+	reduceProgram.unbind();
+}
+
+size_t VoxelFragmentSort::getAllocatedMemory() const {
+	return 2 * (size_t)fragmentCapacity * 3 * sizeof(GLuint) + (size_t)radixBlocks(fragmentCapacity) * RADIX_DIGITS * sizeof(GLuint);
+}
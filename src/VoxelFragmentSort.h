@@ -0,0 +1,53 @@
+#ifndef VOXELFRAGMENTSORT_H
+#define VOXELFRAGMENTSORT_H
+
+#include <Graphics/opengl.h>
+
+#include <vector>
+
+#include "Graphics/GLShaderProgram.h"
+
+// Portable dense grid voxelization for drivers without fp16 image atomics. voxelize.frag appends a fragment
+// per covered voxel keyed by the voxel's Morton code, the list is radix sorted on the GPU so the fragments of
+// a voxel are adjacent, and a segmented reduction averages each run into the voxel textures. No float or
+// compare and swap atomics are involved, so the result is the same on every vendor.
+class VoxelFragmentSort {
+public:
+	VoxelFragmentSort() = default;
+	~VoxelFragmentSort();
+
+	VoxelFragmentSort(const VoxelFragmentSort &other) = delete;
+	VoxelFragmentSort &operator=(const VoxelFragmentSort &other) = delete;
+
+	// Submits the sort shaders, before init so they compile in the background
+	void loadPrograms();
+	std::vector<GLShaderProgram *> getPrograms();
+
+	void init(GLuint capacity);
+	bool isInitialized() const { return lists[0] != 0; }
+
+	// Sets up the fragment list for voxelize.frag. endFragments returns false if it overflowed, after
+	// growing it, the scene then has to be voxelized again.
+	void beginFragments();
+	bool endFragments();
+
+	// Sorts the fragments by the low keyBits bits of their key, 4 bits per pass
+	void sort(int keyBits);
+	// Averages the fragments of each voxel into color and normal, of voxelFormat. Other voxels are left as they are.
+	void reduce(GLuint color, GLuint normal, GLenum voxelFormat);
+
+	GLuint getFragmentCount() const { return fragmentCount; }
+	size_t getAllocatedMemory() const;
+
+private:
+	GLShaderProgram sortProgram, reduceProgram;
+
+	// Fragments are voxelized into lists[0] and sorted back and forth, lists[current] is sorted
+	GLuint lists[2] = { 0, 0 }, histogram = 0;
+	GLuint fragmentCapacity = 0, fragmentCount = 0;
+	int current = 0;
+
+	void allocate(GLuint capacity);
+};
+
+#endif
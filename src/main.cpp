@@ -6,6 +6,7 @@
 #include "common.h"
 #include "Application.h"
 #include "Graphics/GLHelper.h"
+#include "Graphics/GLShaderCompiler.h"
 #include "Input/GLFWHandler.h"
 
 // #define RUN_TEST_TEXTURE2D
@@ -331,6 +332,7 @@ int main() {
 
     LOG_INFO("Exitting...");
 
+    GLShaderCompiler::shutdown();
     glfwTerminate();
 
     return 0;